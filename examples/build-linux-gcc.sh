@@ -6,4 +6,7 @@ rm -f example2-linux-`uname -m`
 gcc -g -Wall example2.c minisdl_audio.c -lm -ldl -lpthread -o example2-linux-`uname -m`
 rm -f miditsf
 gcc -g -Wall -O2 -pg midiplay.c minisdl_audio.c -lm -ldl -lpthread -o midiplay
+#echo Building \'tsftest\' ...
+rm -f tsftest
+gcc -g -Wall tsftest.c -lm -o tsftest
 #echo Done!
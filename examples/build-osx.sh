@@ -2,4 +2,6 @@ echo Building \'example1-osx-`uname -m`\' ...
 clang -Wall example1.c minisdl_audio.c -lm -ldl -lpthread -framework CoreServices -framework CoreAudio -framework AudioUnit -o example1-osx-`uname -m`
 echo Building \'example2-osx-`uname -m`\' ...
 clang -Wall example2.c minisdl_audio.c -lm -ldl -lpthread -framework CoreServices -framework CoreAudio -framework AudioUnit -o example2-osx-`uname -m`
+echo Building \'tsftest\' ...
+clang -Wall tsftest.c -lm -o tsftest
 echo Done!
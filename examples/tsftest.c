@@ -0,0 +1,1019 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A stand-in for stb_vorbis.c that plays the samples stored by MakeSF3 (see below),
+// so the stb_vorbis glue of the library is tested without the real decoder
+#define STB_VORBIS_INCLUDE_STB_VORBIS_H
+typedef struct stb_vorbis { const unsigned char* data; unsigned int length, pos; } stb_vorbis;
+static stb_vorbis* stb_vorbis_open_memory(const unsigned char* data, int len, int* error, const void* alloc_buffer)
+{
+	stb_vorbis* v = (len >= 27 ? (stb_vorbis*)malloc(sizeof(stb_vorbis)) : NULL);
+	(void)alloc_buffer;
+	*error = (v ? 0 : 1);
+	if (v) { v->data = data; v->length = (unsigned int)(len - 27) / 2; v->pos = 0; }
+	return v;
+}
+static int stb_vorbis_seek(stb_vorbis* v, unsigned int sample_number)
+{
+	if (sample_number > v->length) return 0;
+	v->pos = sample_number;
+	return 1;
+}
+static int stb_vorbis_get_samples_short_interleaved(stb_vorbis* v, int channels, short* buffer, int num_shorts)
+{
+	unsigned int n = (unsigned int)num_shorts / channels;
+	if (n > v->length - v->pos) n = v->length - v->pos;
+	memcpy(buffer, v->data + v->pos * 2, n * 2);
+	v->pos += n;
+	return (int)n;
+}
+static void stb_vorbis_close(stb_vorbis* v) { free(v); }
+
+// The allocation number g_AllocFail of the library (counted in g_AllocCount) fails, none if it is negative
+static int g_AllocFail = -1, g_AllocCount, g_AllocFailed;
+static void* TestMalloc(size_t size)
+{
+	if (g_AllocCount++ == g_AllocFail) { g_AllocFailed = 1; return NULL; }
+	return malloc(size);
+}
+static void* TestRealloc(void* ptr, size_t size)
+{
+	if (g_AllocCount++ == g_AllocFail) { g_AllocFailed = 1; return NULL; }
+	return realloc(ptr, size);
+}
+#define TSF_MALLOC  TestMalloc
+#define TSF_REALLOC TestRealloc
+#define TSF_FREE    free
+
+#define TSF_IMPLEMENTATION
+#include "../tsf.h"
+
+// Plays the same notes through the different ways of loading and rendering a SoundFont
+// and compares the output with a plain tsf_load_filename of the file.
+// Run it from the examples directory or pass the path of a SoundFont as the argument.
+// Returns 0 if all tests passed.
+
+#define TEST_SAMPLERATE 44100
+#define TEST_FRAMES (TEST_SAMPLERATE * 4)
+
+// Frames rendered per call, on purpose not a multiple of TSF_RENDER_EFFECTSAMPLEBLOCK
+#define TEST_BLOCK 441
+
+static const char* g_FileName = "florestan-subset.sf2";
+static float g_Reference[TEST_FRAMES * 2], g_Output[TEST_FRAMES * 2];
+static int g_Failures;
+
+// The wrapped streams of tsf_stream_wrap_cached need to stay valid while the tsf instances are open
+static struct tsf_stream g_FileStreams[4];
+static int g_FileStreamNext;
+
+// The file contents for tsf_load_memory, at an even and at an odd address
+static char *g_FileData, *g_FileDataOdd;
+static int g_FileSize;
+
+// Load through a file stream wrapped with tsf_stream_wrap_cached (its read returns 1 instead of the number of bytes)
+static tsf* LoadCachedStream(const char* filename)
+{
+	struct tsf_stream* stdio = &g_FileStreams[g_FileStreamNext++ % 4], cached;
+	FILE* file = fopen(filename, "rb");
+	if (!file) return TSF_NULL;
+	stdio->data = file;
+	stdio->read = (int(*)(void*,void*,unsigned int))&tsf_stream_stdio_read;
+	stdio->tell = (int(*)(void*))&tsf_stream_stdio_tell;
+	stdio->skip = (int(*)(void*,unsigned int))&tsf_stream_stdio_skip;
+	stdio->seek = (int(*)(void*,unsigned int))&tsf_stream_stdio_seek;
+	stdio->close = (int(*)(void*))&tsf_stream_stdio_close;
+	stdio->size = (int(*)(void*))&tsf_stream_stdio_size;
+	return tsf_load(tsf_stream_wrap_cached(stdio, 8, 1024, &cached));
+}
+
+// The ways a SoundFont can be loaded
+enum LoadMode { LOAD_FILENAME, LOAD_CACHED_STREAM, LOAD_MEMORY, LOAD_MEMORY_ODD, LOAD_MMAP };
+
+static tsf* Load(enum LoadMode mode)
+{
+	if (mode == LOAD_FILENAME) return tsf_load_filename(g_FileName);
+	if (mode == LOAD_CACHED_STREAM) return LoadCachedStream(g_FileName);
+	if (mode == LOAD_MEMORY) return tsf_load_memory(g_FileData, g_FileSize);
+	if (mode == LOAD_MEMORY_ODD) return tsf_load_memory(g_FileDataOdd, g_FileSize);
+	#ifdef TSF_HAS_MMAP
+	if (mode == LOAD_MMAP) return tsf_load_mmap(g_FileName);
+	#endif
+	return TSF_NULL;
+}
+
+// Options for Play, the short and mono or unweaved output is converted to interleaved stereo float samples
+enum PlayFlags { PLAY_EFFECTBLOCKS = 1, PLAY_STREAMING = 2, PLAY_SHORT = 4, PLAY_SHORT_FAST = 8, PLAY_MIXING = 16, PLAY_MONO = 32, PLAY_UNWEAVED = 64,
+	PLAY_SWITCH = 128 }; // switch between tsf_render_short and tsf_render_short_fast every block
+
+// Most voices playing at once during the last Play
+static int g_PeakVoices;
+
+// Render 'n' frames with tsf_render_short, tsf_render_short_fast or tsf_render_float and store them in 'out'
+static void RenderBlock(tsf* f, float* out, int n, int flags)
+{
+	static short shorts[TEST_BLOCK * 2];
+	static float floats[TEST_BLOCK * 2];
+	int i, mix = (flags & PLAY_MIXING ? 1000 : 0);
+	if (flags & (PLAY_SHORT | PLAY_SHORT_FAST))
+	{
+		// Mixing adds to a constant which is then removed again
+		for (i = 0; i != n * 2; i++) shorts[i] = (short)mix;
+		if (flags & PLAY_SHORT_FAST) tsf_render_short_fast(f, shorts, n, (mix != 0));
+		else tsf_render_short(f, shorts, n, (mix != 0));
+		for (i = 0; i != n * 2; i++) floats[i] = (shorts[i] - mix) / 32768.0f;
+	}
+	else tsf_render_float(f, floats, n, 0);
+	for (i = 0; i != n; i++)
+	{
+		if (flags & PLAY_MONO) out[i * 2] = out[i * 2 + 1] = floats[i];
+		else if (flags & PLAY_UNWEAVED) out[i * 2] = floats[i], out[i * 2 + 1] = floats[n + i];
+		else out[i * 2] = floats[i * 2], out[i * 2 + 1] = floats[i * 2 + 1];
+	}
+}
+
+// Play overlapping notes of all presets and render them as interleaved stereo float samples
+static void Play(tsf* f, float* out, int flags)
+{
+	int i, j, block, n = 0, presetNum = tsf_get_presetcount(f);
+	tsf_set_output(f, (flags & PLAY_MONO ? TSF_MONO : (flags & PLAY_UNWEAVED ? TSF_STEREO_UNWEAVED : TSF_STEREO_INTERLEAVED)), TEST_SAMPLERATE, -6.0f);
+	g_PeakVoices = 0;
+	for (i = 0; i < TEST_FRAMES; i += TEST_BLOCK)
+	{
+		// A new note every 5 blocks ending the note played 3 notes earlier, all off in the last quarter
+		if ((i / TEST_BLOCK) % 5 == 0 && i < TEST_FRAMES * 3 / 4)
+		{
+			tsf_note_on(f, n % presetNum, 36 + (n * 7) % 48, 0.4f + (n % 4) * 0.2f);
+			if (n >= 3) tsf_note_off(f, (n - 3) % presetNum, 36 + ((n - 3) * 7) % 48);
+			n++;
+		}
+		if (i == TEST_FRAMES * 3 / 4 / TEST_BLOCK * TEST_BLOCK)
+			for (n--; n >= 0; n--) tsf_note_off(f, n % presetNum, 36 + (n * 7) % 48);
+
+		block = (TEST_FRAMES - i < TEST_BLOCK ? TEST_FRAMES - i : TEST_BLOCK);
+		if (flags & PLAY_EFFECTBLOCKS)
+		{
+			// Render one effect block at a time, with streaming load the requested cache blocks
+			// before each of them like an I/O thread that keeps up
+			for (j = 0; j < block; j += TSF_RENDER_EFFECTSAMPLEBLOCK)
+			{
+				if (flags & PLAY_STREAMING) tsf_stream_service(f);
+				tsf_render_float(f, out + (i + j) * 2, (block - j < TSF_RENDER_EFFECTSAMPLEBLOCK ? block - j : TSF_RENDER_EFFECTSAMPLEBLOCK), 0);
+			}
+		}
+		else if ((flags & PLAY_SWITCH) && (i / TEST_BLOCK) % 2) RenderBlock(f, out + i * 2, block, flags | PLAY_SHORT_FAST);
+		else if (flags & (PLAY_SHORT | PLAY_SHORT_FAST | PLAY_SWITCH | PLAY_MONO | PLAY_UNWEAVED)) RenderBlock(f, out + i * 2, block, flags | (flags & PLAY_SWITCH ? PLAY_SHORT : 0));
+		else tsf_render_float(f, out + i * 2, block, 0);
+		if (f->activeVoiceNum > g_PeakVoices) g_PeakVoices = f->activeVoiceNum;
+	}
+}
+
+// Compare the output with a reference, it needs to be the same if minSNR is 0
+// or otherwise have a signal to noise ratio of at least minSNR decibels
+static void Check(const char* name, const float* out, const float* ref, double minSNR)
+{
+	double signal = 0, noise = 0, snr;
+	int i, same = 1;
+	for (i = 0; i != TEST_FRAMES * 2; i++)
+	{
+		double d = (double)out[i] - ref[i];
+		signal += (double)ref[i] * ref[i];
+		noise += d * d;
+		if (out[i] != ref[i]) same = 0;
+	}
+	snr = (noise > 0 ? 10.0 * log10(signal / noise) : 999.0);
+	if (minSNR ? snr < minSNR : !same)
+	{
+		printf("FAILED %-44s SNR %.1f dB\n", name, snr);
+		g_Failures++;
+	}
+	else if (same) printf("ok     %-44s identical\n", name);
+	else printf("ok     %-44s SNR %.1f dB\n", name, snr);
+}
+
+static void Fail(const char* name, const char* reason)
+{
+	printf("FAILED %-44s %s\n", name, reason);
+	g_Failures++;
+}
+
+// Load with each allocation of the load failing in turn, it needs to fail or play the same as 'ref'
+static void TestAllocFailures(const char* name, tsf* (*load)(void), const float* ref)
+{
+	int n;
+	tsf* f;
+	for (n = 0;; n++)
+	{
+		g_AllocFail = n;
+		g_AllocCount = g_AllocFailed = 0;
+		f = load();
+		g_AllocFail = -1;
+		if (!f && !g_AllocFailed) { Fail(name, "load error"); return; }
+		if (!f) continue;
+		Play(f, g_Output, 0);
+		tsf_close(f);
+		if (memcmp(g_Output, ref, sizeof(g_Output))) { printf("FAILED %-44s plays differently with allocation %d failing\n", name, n); g_Failures++; return; }
+		if (!g_AllocFailed) break;
+	}
+	printf("ok     %-44s %d allocations\n", name, n);
+}
+
+static tsf* LoadFilename(void) { return tsf_load_filename(g_FileName); }
+
+static void TestSampleCache(void)
+{
+	static const int geometries[][2] = { { 1, 64 }, { 4, 300 }, { 64, 2048 } };
+	struct tsf_cache_stats stats;
+	char name[64];
+	int i, mode;
+	for (mode = LOAD_FILENAME; mode <= LOAD_CACHED_STREAM; mode++)
+	{
+		for (i = 0; i != sizeof(geometries) / sizeof(*geometries); i++)
+		{
+			tsf* f = Load((enum LoadMode)mode);
+			sprintf(name, "sample cache %dx%d%s", geometries[i][0], geometries[i][1], (mode == LOAD_CACHED_STREAM ? " (cached stream)" : ""));
+			if (!f || !tsf_set_sample_cache(f, geometries[i][0], geometries[i][1])) { Fail(name, "load or cache setup error"); if (f) tsf_close(f); continue; }
+			Play(f, g_Output, 0);
+			Check(name, g_Output, g_Reference, 0);
+
+			// Every miss reads one block, with a single block every miss after the first evicts it
+			tsf_get_cache_stats(f, &stats, 1);
+			if (!stats.hits || !stats.misses || stats.underruns || stats.bytesRead != stats.misses * geometries[i][1] * sizeof(short)
+				|| (geometries[i][0] == 1 && stats.evictions != stats.misses - 1))
+				Fail(name, "unexpected cache statistics");
+			tsf_get_cache_stats(f, &stats, 0);
+			if (stats.hits || stats.misses || stats.evictions || stats.bytesRead)
+				Fail(name, "cache statistics not reset");
+			tsf_close(f);
+		}
+	}
+
+	// Loading fails if the cache can't be allocated
+	TestAllocFailures("load allocation failures", LoadFilename, g_Reference);
+}
+
+static void TestStreaming(void)
+{
+	static float reference[TEST_FRAMES * 2];
+	struct tsf_cache_stats stats;
+	tsf* f;
+
+	// Streaming is compared with rendering the same effect blocks without it, compared to
+	// the reference only the order in which voices are mixed (and so float rounding) changes
+	f = Load(LOAD_FILENAME);
+	Play(f, reference, PLAY_EFFECTBLOCKS);
+	tsf_close(f);
+	Check("rendering by effect blocks", reference, g_Reference, 120);
+
+	f = Load(LOAD_CACHED_STREAM);
+	if (!f || !tsf_set_sample_cache(f, 64, 1024)) { Fail("streaming", "load or cache setup error"); if (f) tsf_close(f); return; }
+	tsf_set_streaming(f, 1);
+	Play(f, g_Output, PLAY_EFFECTBLOCKS | PLAY_STREAMING);
+	tsf_set_streaming(f, 0);
+	Check("streaming", g_Output, reference, 0);
+	tsf_get_cache_stats(f, &stats, 0);
+	if (stats.underruns) Fail("streaming", "underruns with all requested blocks loaded");
+	tsf_close(f);
+}
+
+static void TestPreloadSamples(void)
+{
+	char name[64];
+	int mode;
+	for (mode = LOAD_FILENAME; mode <= LOAD_CACHED_STREAM; mode++)
+	{
+		tsf* f = Load((enum LoadMode)mode);
+		sprintf(name, "preload samples%s", (mode == LOAD_CACHED_STREAM ? " (cached stream)" : ""));
+		if (!f || !tsf_preload_samples(f)) { Fail(name, "load or preload error"); if (f) tsf_close(f); continue; }
+		if (tsf_set_sample_cache(f, 4, 300) || f->cache.blocks) Fail(name, "sample cache allocated");
+		Play(f, g_Output, 0);
+		Check(name, g_Output, g_Reference, 0);
+		tsf_close(f);
+	}
+}
+
+static tsf* LoadPreloadHydra(void)
+{
+	tsf* f = tsf_load_filename(g_FileName);
+	if (f && !tsf_preload_hydra(f)) { tsf_close(f); return TSF_NULL; }
+	return f;
+}
+
+static void TestPreloadHydra(void)
+{
+	char name[64];
+	int mode;
+	for (mode = LOAD_FILENAME; mode <= LOAD_CACHED_STREAM; mode++)
+	{
+		tsf* f = Load((enum LoadMode)mode);
+		sprintf(name, "preload hydra%s", (mode == LOAD_CACHED_STREAM ? " (cached stream)" : ""));
+		if (!f || !tsf_preload_hydra(f)) { Fail(name, "load or preload error"); if (f) tsf_close(f); continue; }
+		Play(f, g_Output, 0);
+		Check(name, g_Output, g_Reference, 0);
+		tsf_close(f);
+	}
+	TestAllocFailures("preload hydra allocation failures", LoadPreloadHydra, g_Reference);
+}
+
+static void TestPreloadPresets(void)
+{
+	int i, presetNum;
+	tsf* f = Load(LOAD_FILENAME);
+	if (!f || !tsf_preload_presets(f, TSF_NULL, 0)) Fail("preload presets", "load or preload error");
+	else
+	{
+		Play(f, g_Output, 0);
+		Check("preload presets", g_Output, g_Reference, 0);
+	}
+	if (f) tsf_close(f);
+
+	// The queued presets are loaded by tsf_stream_service (on this thread here)
+	f = Load(LOAD_CACHED_STREAM);
+	if (!f) { Fail("preload presets async", "load error"); return; }
+	presetNum = tsf_get_presetcount(f);
+	if (tsf_preload_presets_async(f, TSF_NULL, 0) != presetNum || tsf_get_presetloaded(f, 0)) Fail("preload presets async", "presets not queued");
+	if (tsf_stream_service(f) != presetNum) Fail("preload presets async", "presets not loaded by tsf_stream_service");
+	for (i = 0; i != presetNum; i++)
+		if (!tsf_get_presetloaded(f, i)) { Fail("preload presets async", "preset not loaded"); break; }
+	Play(f, g_Output, 0);
+	Check("preload presets async", g_Output, g_Reference, 0);
+
+	// Preset indices are sorted by bank and preset number (the first of duplicates is found)
+	for (i = 0; i != presetNum; i++)
+	{
+		int index = tsf_get_presetindex(f, f->presets[i].bank, f->presets[i].preset);
+		if (index < 0 || index > i || f->presets[index].bank != f->presets[i].bank || f->presets[index].preset != f->presets[i].preset) break;
+	}
+	if (i != presetNum || tsf_get_presetindex(f, 128, 128) != -1) Fail("preset index", "wrong index");
+	tsf_close(f);
+}
+
+static void TestResident(void)
+{
+	static const char* names[] = { "load memory", "load memory (odd address)", "load mmap" };
+	int mode;
+	#ifdef TSF_HAS_MMAP
+	const int lastMode = LOAD_MMAP;
+	#else
+	const int lastMode = LOAD_MEMORY_ODD;
+	#endif
+	for (mode = LOAD_MEMORY; mode <= lastMode; mode++)
+	{
+		tsf* f = Load((enum LoadMode)mode);
+		if (!f) { Fail(names[mode - LOAD_MEMORY], "load error"); continue; }
+		// Sample data at an odd address can't be played in place and goes through the sample cache
+		if ((mode == LOAD_MEMORY_ODD) != !f->fontSamples) Fail(names[mode - LOAD_MEMORY], "samples not played from the expected place");
+		else if (f->fontSamples && (tsf_set_sample_cache(f, 4, 300) || f->cache.blocks)) Fail(names[mode - LOAD_MEMORY], "sample cache allocated");
+		Play(f, g_Output, 0);
+		Check(names[mode - LOAD_MEMORY], g_Output, g_Reference, 0);
+		tsf_close(f);
+	}
+}
+
+// The bank for LoadBank
+static const char* g_BankData;
+static int g_BankSize;
+static tsf* LoadBank(void) { return tsf_load_memory(g_BankData, g_BankSize); }
+
+static void TestBank(void)
+{
+	char *bank = TSF_NULL, *bankFromStream = TSF_NULL;
+	int size, sizeFromStream;
+	tsf *f, *loaded;
+
+	// A bank saved from a cached stream needs to be the same as one saved from a file
+	f = Load(LOAD_FILENAME);
+	size = (f ? tsf_save_bank_memory(f, TSF_NULL, 0) : 0);
+	if (size) bank = (char*)malloc(size);
+	if (!bank || tsf_save_bank_memory(f, bank, size) != size) { Fail("save bank", "save error"); size = 0; }
+	if (f) tsf_close(f);
+	f = Load(LOAD_CACHED_STREAM);
+	sizeFromStream = (f ? tsf_save_bank_memory(f, TSF_NULL, 0) : 0);
+	if (sizeFromStream) bankFromStream = (char*)malloc(sizeFromStream);
+	if (!bankFromStream || tsf_save_bank_memory(f, bankFromStream, sizeFromStream) != sizeFromStream) Fail("save bank (cached stream)", "save error");
+	else if (sizeFromStream != size || memcmp(bank, bankFromStream, size)) Fail("save bank (cached stream)", "different bank data");
+	if (f) tsf_close(f);
+	free(bankFromStream);
+	if (!size) { free(bank); return; }
+
+	loaded = tsf_load_memory(bank, size);
+	if (!loaded) Fail("load bank", "load error");
+	else
+	{
+		Play(loaded, g_Output, 0);
+		Check("load bank", g_Output, g_Reference, 0);
+		tsf_close(loaded);
+	}
+
+	// Loading fails if the memory for the presets or the sample cache (used at an odd address) can't be allocated
+	g_BankData = bank;
+	g_BankSize = size;
+	TestAllocFailures("load bank allocation failures", LoadBank, g_Reference);
+	if ((bankFromStream = (char*)malloc(size + 1)) != TSF_NULL)
+	{
+		memcpy(bankFromStream + 1, bank, size);
+		g_BankData = bankFromStream + 1;
+		TestAllocFailures("load bank allocation failures (odd address)", LoadBank, g_Reference);
+		free(bankFromStream);
+	}
+	free(bank);
+
+	#ifdef TSF_HAS_MMAP
+	f = Load(LOAD_FILENAME);
+	if (!f || !tsf_save_bank_filename(f, "tsftest.bank")) Fail("save bank file", "save error");
+	else if (!(loaded = tsf_load_mmap("tsftest.bank"))) Fail("load bank mmap", "load error");
+	else
+	{
+		Play(loaded, g_Output, 0);
+		Check("load bank mmap", g_Output, g_Reference, 0);
+		tsf_close(loaded);
+	}
+	if (f) tsf_close(f);
+	remove("tsftest.bank");
+	#endif
+}
+
+static unsigned int Read32(const char* p) { return (unsigned char)p[0] | ((unsigned char)p[1] << 8) | ((unsigned char)p[2] << 16) | ((unsigned int)(unsigned char)p[3] << 24); }
+static void Write32(char* p, unsigned int v) { p[0] = (char)v; p[1] = (char)(v >> 8); p[2] = (char)(v >> 16); p[3] = (char)(v >> 24); }
+
+// Find a chunk in a list of chunks, returns a pointer to its data
+static const char* FindChunk(const char* p, const char* end, const char* id, const char* listType, unsigned int* size)
+{
+	for (; p + 8 <= end; p += 8 + ((Read32(p + 4) + 1) & ~1))
+		if (!memcmp(p, id, 4) && (!listType || !memcmp(p + 8, listType, 4))) { *size = Read32(p + 4); return p + 8; }
+	return TSF_NULL;
+}
+
+// Convert the SoundFont in g_FileData into an SF3 file with each sample stored as its 16-bit samples
+// followed by the header of an empty last Ogg page with the number of samples as its granule position.
+// This is enough for the library to find the decoded length, TestDecoder plays the samples back.
+static char* MakeSF3(int* outSize)
+{
+	const char *end, *sdta, *pdta, *smpl, *shdr, *p;
+	unsigned int riffSize, sdtaSize, pdtaSize, smplSize, shdrSize, i, shdrNum, compressedSize = 0, offset;
+	char *res, *out, *outShdr = TSF_NULL;
+	if (g_FileSize < 12 || memcmp(g_FileData, "RIFF", 4)) return TSF_NULL;
+	riffSize = Read32(g_FileData + 4);
+	if (riffSize > (unsigned int)g_FileSize - 8) return TSF_NULL;
+	end = g_FileData + 8 + riffSize;
+	if (!(sdta = FindChunk(g_FileData + 12, end, "LIST", "sdta", &sdtaSize)) || !(smpl = FindChunk(sdta + 4, sdta + sdtaSize, "smpl", TSF_NULL, &smplSize))) return TSF_NULL;
+	if (!(pdta = FindChunk(g_FileData + 12, end, "LIST", "pdta", &pdtaSize)) || !(shdr = FindChunk(pdta + 4, pdta + pdtaSize, "shdr", TSF_NULL, &shdrSize))) return TSF_NULL;
+	shdrNum = shdrSize / 46;
+	for (i = 0; i + 1 < shdrNum; i++)
+	{
+		unsigned int start = Read32(shdr + i * 46 + 20), stop = Read32(shdr + i * 46 + 24);
+		if (start < stop && stop <= smplSize / 2) compressedSize += (stop - start) * 2 + 27;
+	}
+
+	// Copy all chunks but replace the sample data
+	res = out = (char*)malloc(g_FileSize + compressedSize + 32);
+	if (!res) return TSF_NULL;
+	memcpy(out, g_FileData, 12);
+	out += 12;
+	for (p = g_FileData + 12; p + 8 <= end; p += 8 + ((Read32(p + 4) + 1) & ~1))
+	{
+		unsigned int size = Read32(p + 4);
+		if (p + 8 == pdta) outShdr = out + (shdr - p);
+		if (p + 8 != sdta)
+		{
+			memcpy(out, p, 8 + ((size + 1) & ~1));
+			out += 8 + ((size + 1) & ~1);
+			continue;
+		}
+		memcpy(out, "LIST", 4);
+		Write32(out + 4, 4 + 8 + ((compressedSize + 1) & ~1));
+		memcpy(out + 8, "sdtasmpl", 8);
+		Write32(out + 16, compressedSize);
+		out += 20;
+		for (i = 0; i + 1 < shdrNum; i++)
+		{
+			unsigned int start = Read32(shdr + i * 46 + 20), stop = Read32(shdr + i * 46 + 24);
+			if (start >= stop || stop > smplSize / 2) continue;
+			memcpy(out, smpl + start * 2, (stop - start) * 2);
+			out += (stop - start) * 2;
+			memset(out, 0, 27);
+			memcpy(out, "OggS", 4);
+			out[5] = 4; // last page of the stream
+			Write32(out + 6, stop - start);
+			out += 27;
+		}
+		if (compressedSize & 1) *(out++) = 0;
+	}
+	Write32(res + 4, (unsigned int)(out - res) - 8);
+
+	// Compressed samples have their start and end in bytes and their loop points relative to the start
+	for (i = 0, offset = 0; i + 1 < shdrNum; i++)
+	{
+		char* h = outShdr + i * 46;
+		unsigned int start = Read32(h + 20), stop = Read32(h + 24);
+		if (start >= stop || stop > smplSize / 2) continue;
+		Write32(h + 20, offset);
+		Write32(h + 24, offset + (stop - start) * 2 + 27);
+		Write32(h + 28, Read32(h + 28) - start);
+		Write32(h + 32, Read32(h + 32) - start);
+		h[44] |= 0x10;
+		offset += (stop - start) * 2 + 27;
+	}
+	*outSize = (int)(out - res);
+	return res;
+}
+
+// Add an sm24 chunk with all low bytes set to 'low' to the SoundFont in g_FileData
+static char* Make24(int* outSize, unsigned char low)
+{
+	const char *end, *sdta, *smpl, *p;
+	unsigned int riffSize, sdtaSize, smplSize, sm24Size;
+	char *res, *out;
+	if (g_FileSize < 12 || memcmp(g_FileData, "RIFF", 4)) return TSF_NULL;
+	riffSize = Read32(g_FileData + 4);
+	if (riffSize > (unsigned int)g_FileSize - 8) return TSF_NULL;
+	end = g_FileData + 8 + riffSize;
+	if (!(sdta = FindChunk(g_FileData + 12, end, "LIST", "sdta", &sdtaSize)) || !(smpl = FindChunk(sdta + 4, sdta + sdtaSize, "smpl", TSF_NULL, &smplSize))) return TSF_NULL;
+	if (FindChunk(sdta + 4, sdta + sdtaSize, "sm24", TSF_NULL, &sm24Size)) return TSF_NULL;
+	sm24Size = smplSize / 2;
+
+	// Insert the chunk right after the smpl chunk and grow the sizes of the lists around it
+	res = out = (char*)malloc(g_FileSize + sm24Size + 10);
+	if (!res) return TSF_NULL;
+	p = smpl + ((smplSize + 1) & ~1);
+	memcpy(out, g_FileData, p - g_FileData);
+	out += p - g_FileData;
+	memcpy(out, "sm24", 4);
+	Write32(out + 4, sm24Size);
+	memset(out + 8, low, sm24Size);
+	out += 8 + ((sm24Size + 1) & ~1);
+	memcpy(out, p, g_FileData + g_FileSize - p);
+	out += g_FileData + g_FileSize - p;
+	Write32(res + 4, riffSize + (unsigned int)(out - res) - g_FileSize);
+	Write32(res + (sdta - 4 - g_FileData), sdtaSize + (unsigned int)(out - res) - g_FileSize);
+	*outSize = (int)(out - res);
+	return res;
+}
+
+static void Test24Bit(void)
+{
+	static float reference[TEST_FRAMES * 2];
+	char* sf2;
+	int size, low, i;
+	for (low = 0; low <= 0x80; low += 0x80)
+	{
+		sf2 = Make24(&size, (unsigned char)low);
+		if (!sf2) { Fail("24-bit", "SoundFont could not be converted"); return; }
+		for (i = 0; i != 3; i++)
+		{
+			static const char* names[2][3] = { { "24-bit zero low bytes", "24-bit zero low bytes preloaded", "24-bit zero low bytes odd address" },
+				{ "24-bit", "24-bit preloaded", "24-bit odd address" } };
+			char* buffer = (i == 2 ? (char*)malloc(size + 1) + 1 : sf2);
+			tsf* f;
+			if (i == 2) memcpy(buffer, sf2, size);
+			f = tsf_load_memory(buffer, size);
+			if (!f || !f->fontSamples24Offset || (i == 1 && !tsf_preload_samples(f))) { Fail(names[!!low][i], "load error"); if (f) tsf_close(f); }
+			else
+			{
+				// Zero low bytes play the same as the 16-bit samples, otherwise they add half a 16-bit step
+				Play(f, (i ? g_Output : reference), 0);
+				if (i) Check(names[!!low][i], g_Output, reference, 0);
+				else Check(names[!!low][i], reference, g_Reference, (low ? 60 : 0));
+				tsf_close(f);
+			}
+			if (i == 2) free(buffer - 1);
+		}
+		free(sf2);
+	}
+}
+
+// A decoder for the samples stored by MakeSF3
+struct TestSample { const char* data; unsigned int length; };
+
+static void* TestDecoderOpen(void* data, const void* compressed, unsigned int size)
+{
+	struct TestSample* s = (struct TestSample*)malloc(sizeof(struct TestSample));
+	(void)data;
+	if (!s || size < 27) { free(s); return TSF_NULL; }
+	s->data = (const char*)compressed;
+	s->length = (size - 27) / 2;
+	return s;
+}
+
+static int TestDecoderDecode(void* data, void* handle, unsigned int pos, short* out, unsigned int count)
+{
+	struct TestSample* s = (struct TestSample*)handle;
+	(void)data;
+	if (pos >= s->length) return 0;
+	if (count > s->length - pos) count = s->length - pos;
+	memcpy(out, s->data + pos * 2, count * 2);
+	return (int)count;
+}
+
+static void TestDecoderClose(void* data, void* handle)
+{
+	(void)data;
+	free(handle);
+}
+
+static tsf* LoadSF3(void) { return tsf_load_filename("tsftest.sf3"); }
+
+static void TestDecoder(void)
+{
+	static const struct tsf_sample_decoder decoder = { TSF_NULL, TestDecoderOpen, TestDecoderDecode, TestDecoderClose };
+	static float reference[TEST_FRAMES * 2];
+	static const struct { const char* name; enum LoadMode mode; int customDecoder, preload, cacheBlocks; } tests[] =
+	{
+		{ "sf3",                                  LOAD_FILENAME,      1, 0, 0 },
+		{ "sf3 from cached stream",               LOAD_CACHED_STREAM, 1, 0, 0 },
+		{ "sf3 from memory",                      LOAD_MEMORY,        1, 0, 0 },
+		{ "sf3 preloaded from cached stream",     LOAD_CACHED_STREAM, 1, 1, 0 },
+		{ "sf3 with sample cache 1x64",           LOAD_FILENAME,      1, 0, 1 },
+		{ "sf3 stb_vorbis glue",                  LOAD_FILENAME,      0, 0, 0 },
+		{ "sf3 stb_vorbis glue with cache 1x64",  LOAD_CACHED_STREAM, 0, 0, 1 },
+	};
+	FILE* file;
+	char* sf3;
+	int size, i, j;
+	tsf* f;
+
+	// Write the SF3 file for the stream loads
+	sf3 = MakeSF3(&size);
+	if (!sf3) { Fail("sf3", "SoundFont could not be converted"); return; }
+	file = fopen("tsftest.sf3", "wb");
+	if (!file || fwrite(sf3, 1, size, file) != (size_t)size) { Fail("sf3", "file could not be written"); if (file) fclose(file); free(sf3); return; }
+	fclose(file);
+
+	for (i = 0; i != sizeof(tests) / sizeof(*tests); i++)
+	{
+		if (tests[i].mode == LOAD_MEMORY) f = tsf_load_memory(sf3, size);
+		else if (tests[i].mode == LOAD_CACHED_STREAM) f = LoadCachedStream("tsftest.sf3");
+		else f = tsf_load_filename("tsftest.sf3");
+		if (!f || !f->compressedNum) { Fail(tests[i].name, "load error"); if (f) tsf_close(f); continue; }
+		if (tests[i].customDecoder) tsf_set_sample_decoder(f, &decoder);
+		if ((tests[i].preload && !tsf_preload_samples(f)) || (tests[i].cacheBlocks && !tsf_set_sample_cache(f, tests[i].cacheBlocks, 64)))
+			{ Fail(tests[i].name, "preload or cache setup error"); tsf_close(f); continue; }
+
+		// Samples are at other positions than in the SoundFont which changes the float rounding of
+		// the playback position, the other ways of loading it need to play exactly the same as the first
+		Play(f, (i ? g_Output : reference), 0);
+		if (i) Check(tests[i].name, g_Output, reference, 0);
+		else Check(tests[i].name, reference, g_Reference, 120);
+		tsf_close(f);
+	}
+
+	// The compressed samples are played through the stb_vorbis glue by default
+	TestAllocFailures("sf3 allocation failures", LoadSF3, reference);
+
+	// Without a decoder compressed samples are silent
+	f = tsf_load_memory(sf3, size);
+	if (f)
+	{
+		tsf_set_sample_decoder(f, TSF_NULL);
+		Play(f, g_Output, 0);
+		for (j = 0; j != TEST_FRAMES * 2 && !g_Output[j]; j++) {}
+		if (j != TEST_FRAMES * 2) Fail("sf3 without decoder", "not silent");
+		tsf_close(f);
+	}
+	free(sf3);
+	remove("tsftest.sf3");
+}
+
+static void TestInterpolation(void)
+{
+	static float reference[TEST_FRAMES * 2];
+	static const char* names[] = { "nearest", "linear", "hermite", "sinc8", "sinc16" };
+	static const char* variants[] = { "", " (preloaded)", " (cache 1x64)", " (cache 3x100, stream)", " (24-bit)", " (24-bit, cache)" };
+	char name[80], *sf24, *sf24Odd;
+	int interpolation, variant, size24;
+	tsf* f;
+
+	// 24-bit samples with zero low bytes play the same as the 16-bit samples, in place or through the cache (at an odd address)
+	sf24 = Make24(&size24, 0);
+	sf24Odd = (char*)malloc(size24 + 1) + 1;
+	if (sf24) memcpy(sf24Odd, sf24, size24);
+
+	for (interpolation = TSF_INTERPOLATION_NEAREST; interpolation <= TSF_INTERPOLATION_SINC16; interpolation++)
+	{
+		for (variant = 0; variant != sizeof(variants) / sizeof(*variants); variant++)
+		{
+			f = (variant == 4 ? (sf24 ? tsf_load_memory(sf24, size24) : TSF_NULL) : (variant == 5 ? (sf24 ? tsf_load_memory(sf24Odd, size24) : TSF_NULL) :
+				Load(variant == 3 ? LOAD_CACHED_STREAM : LOAD_FILENAME)));
+			sprintf(name, "interpolation %s%s", names[interpolation], variants[variant]);
+			if (!f || !tsf_set_interpolation(f, (enum TSFInterpolation)interpolation)
+				|| (variant == 1 && !tsf_preload_samples(f)) || (variant == 2 && !tsf_set_sample_cache(f, 1, 64)) || (variant == 3 && !tsf_set_sample_cache(f, 3, 100)))
+				{ Fail(name, "load or setup error"); if (f) tsf_close(f); continue; }
+
+			// All ways of reading the samples need to play the same, the modes are compared with linear
+			// interpolation (the reference) to make sure they play the notes at all
+			Play(f, (variant ? g_Output : reference), 0);
+			if (variant) Check(name, g_Output, reference, 0);
+			else Check(name, reference, g_Reference, (interpolation == TSF_INTERPOLATION_LINEAR ? 0 : 10));
+			tsf_close(f);
+		}
+	}
+
+	// Unknown interpolations are rejected and keep the previous setting
+	f = Load(LOAD_FILENAME);
+	if (!f || tsf_set_interpolation(f, (enum TSFInterpolation)(TSF_INTERPOLATION_SINC16 + 1)) || tsf_set_interpolation(f, (enum TSFInterpolation)-1)) Fail("interpolation unknown", "accepted");
+	else
+	{
+		Play(f, g_Output, 0);
+		Check("interpolation unknown", g_Output, g_Reference, 0);
+	}
+	if (f) tsf_close(f);
+	free(sf24);
+	free(sf24Odd - 1);
+}
+
+// The vector interpolation of unfiltered 16-bit runs gives the same values as the scalar code
+static void TestLinearRuns(void)
+{
+	#if defined(TSF_SSE2) || defined(TSF_NEON)
+	static const double ratios[] = { 1.0, 0.4999, 1.3333, 2.75, 7.1 };
+	static short data[2048];
+	float block[TSF_RENDER_EFFECTSAMPLEBLOCK];
+	double position, p;
+	int i, r, start, n, wrong = 0;
+	for (i = 0; i != 2048; i++) data[i] = (short)((i * 7919) % 65536 - 32768);
+	for (r = 0; r != sizeof(ratios) / sizeof(*ratios); r++)
+	{
+		for (start = 0; start != 8; start++)
+		{
+			position = p = 1000.3 + start * 0.37;
+			n = tsf_interpolate_linear_run(block, start, TSF_RENDER_EFFECTSAMPLEBLOCK, &position, ratios[r], data + 1000 - start, 1000 - start);
+			if (n < TSF_RENDER_EFFECTSAMPLEBLOCK - 7) wrong++;
+			for (i = start; i != n; i++, p += ratios[r])
+			{
+				unsigned int pos = (unsigned int)p;
+				float alpha = (float)(p - pos), y0 = data[pos] * (1.0f / 32767.0f), y1 = data[pos + 1] * (1.0f / 32767.0f), delta = (y1 - y0) * alpha;
+				#ifdef __FMA__
+				// A compiler can contract the scalar and vector code into fused multiply-adds differently
+				if (fabsf(block[i] - (y0 + delta)) > 1e-6f) wrong++;
+				#else
+				if (block[i] != y0 + delta) wrong++;
+				#endif
+			}
+			if (position != p) wrong++;
+		}
+	}
+	if (wrong) Fail("linear interpolation runs", "different from the scalar interpolation");
+	else printf("ok     %-44s identical\n", "linear interpolation runs");
+	#endif
+}
+
+static void TestRenderShort(void)
+{
+	static float reference[TEST_FRAMES * 2], fast[TEST_FRAMES * 2];
+	static short loud[2][TEST_FRAMES];
+	static const struct { const char* name; int flags; } modes[] = { { "interleaved", 0 }, { "unweaved", PLAY_UNWEAVED }, { "mono", PLAY_MONO } };
+	static const char* names[] = { "nearest", "linear", "hermite", "sinc8", "sinc16" };
+	char name[80], *sf24;
+	int mode, interpolation, size24, i;
+	tsf* f;
+
+	// The integer rendering of tsf_render_short_fast is close to tsf_render_short in all output modes,
+	// which is tsf_render_float converted to 16-bit
+	for (mode = 0; mode != sizeof(modes) / sizeof(*modes); mode++)
+	{
+		if ((f = Load(LOAD_FILENAME)) == TSF_NULL) { Fail("render short", "load error"); return; }
+		Play(f, reference, modes[mode].flags);
+		tsf_close(f);
+
+		f = Load(LOAD_FILENAME);
+		Play(f, g_Output, modes[mode].flags | PLAY_SHORT);
+		sprintf(name, "render short %s", modes[mode].name);
+		Check(name, g_Output, reference, 70);
+		tsf_close(f);
+
+		f = Load(LOAD_FILENAME);
+		Play(f, fast, modes[mode].flags | PLAY_SHORT_FAST);
+		sprintf(name, "render short fast %s", modes[mode].name);
+		Check(name, fast, g_Output, 60);
+		tsf_close(f);
+
+		// Mixing into the buffer adds exactly the same samples
+		f = Load(LOAD_FILENAME);
+		Play(f, g_Output, modes[mode].flags | PLAY_SHORT_FAST | PLAY_MIXING);
+		sprintf(name, "render short fast %s mixing", modes[mode].name);
+		Check(name, g_Output, fast, 0);
+		tsf_close(f);
+	}
+
+	// The integer interpolation
+	for (interpolation = TSF_INTERPOLATION_NEAREST; interpolation <= TSF_INTERPOLATION_SINC16; interpolation++)
+	{
+		f = Load(LOAD_FILENAME);
+		tsf_set_interpolation(f, (enum TSFInterpolation)interpolation);
+		Play(f, reference, PLAY_SHORT);
+		tsf_close(f);
+		f = Load(LOAD_FILENAME);
+		tsf_set_interpolation(f, (enum TSFInterpolation)interpolation);
+		Play(f, g_Output, PLAY_SHORT_FAST);
+		sprintf(name, "render short fast %s", names[interpolation]);
+		Check(name, g_Output, reference, 60);
+		tsf_close(f);
+	}
+	// 24-bit samples with zero low bytes play the same as the 16-bit samples
+	f = Load(LOAD_FILENAME);
+	Play(f, fast, PLAY_SHORT_FAST);
+	tsf_close(f);
+	if ((sf24 = Make24(&size24, 0)) != TSF_NULL && (f = tsf_load_memory(sf24, size24)) != TSF_NULL)
+	{
+		Play(f, g_Output, PLAY_SHORT_FAST);
+		Check("render short fast 24-bit zero low bytes", g_Output, fast, 0);
+		tsf_close(f);
+	}
+	else Fail("render short fast 24-bit", "load error");
+	free(sf24);
+
+	// Voices keep their position and filter state when switching between the float and integer rendering
+	f = Load(LOAD_FILENAME);
+	Play(f, reference, PLAY_SHORT);
+	tsf_close(f);
+	f = Load(LOAD_FILENAME);
+	Play(f, g_Output, PLAY_SWITCH);
+	Check("render short fast switching", g_Output, reference, 60);
+	tsf_close(f);
+
+	// Gains beyond what the integer gain can hold are clamped, a loud note saturates like with tsf_render_short
+	for (mode = 0; mode != 2; mode++)
+	{
+		f = Load(LOAD_FILENAME);
+		tsf_set_output(f, TSF_MONO, TEST_SAMPLERATE, 60.0f);
+		tsf_note_on(f, 0, 60, 1.0f);
+		for (i = 0; i != TEST_FRAMES; i += TEST_BLOCK)
+		{
+			if (mode) tsf_render_short_fast(f, loud[1] + i, (TEST_FRAMES - i < TEST_BLOCK ? TEST_FRAMES - i : TEST_BLOCK), 0);
+			else tsf_render_short(f, loud[0] + i, (TEST_FRAMES - i < TEST_BLOCK ? TEST_FRAMES - i : TEST_BLOCK), 0);
+		}
+		tsf_close(f);
+	}
+	for (i = 0; i != TEST_FRAMES && (loud[0][i] > -16384 || loud[1][i] < 0) && (loud[0][i] < 16384 || loud[1][i] > 0); i++) {}
+	if (i != TEST_FRAMES) Fail("render short fast loud", "output wrapped around");
+	else printf("ok     %-44s saturated\n", "render short fast loud");
+}
+
+static void TestMaxVoices(void)
+{
+	static const int limits[] = { 64, 8, 3, 1 };
+	struct tsf_voice* voices;
+	char name[80];
+	int i, j;
+	tsf* f;
+	for (i = 0; i != sizeof(limits) / sizeof(*limits); i++)
+	{
+		sprintf(name, "max voices %d", limits[i]);
+		if ((f = Load(LOAD_FILENAME)) == TSF_NULL || !tsf_set_max_voices(f, limits[i])) { Fail(name, "load or setup error"); if (f) tsf_close(f); continue; }
+
+		// The pool is allocated once, the voices beyond the limit only fade out
+		voices = f->voices;
+		Play(f, g_Output, 0);
+		if (f->voices != voices || f->voiceNum != limits[i] + TSF_VOICE_FADE_RESERVE) Fail(name, "voice pool reallocated");
+		else if (g_PeakVoices > limits[i] + TSF_VOICE_FADE_RESERVE) Fail(name, "too many voices playing");
+		else if (limits[i] == 64) Check(name, g_Output, g_Reference, 0); // more voices than the notes need
+		else
+		{
+			// Notes are cut short by the new ones
+			for (j = 0; j != TEST_FRAMES * 2 && g_Output[j] == g_Reference[j]; j++) {}
+			if (j == TEST_FRAMES * 2) Fail(name, "no voice was stolen");
+			else printf("ok     %-44s peak of %d playing\n", name, g_PeakVoices);
+		}
+
+		// Without a limit the pool grows again as needed
+		sprintf(name, "max voices %d then unlimited", limits[i]);
+		if (!tsf_set_max_voices(f, 0)) Fail(name, "setup error");
+		else { Play(f, g_Output, 0); Check(name, g_Output, g_Reference, 0); }
+		tsf_close(f);
+	}
+}
+
+// Render 'ms' milliseconds into g_Output
+static void Render(tsf* f, int ms)
+{
+	tsf_render_float(f, g_Output, TEST_SAMPLERATE * ms / 1000, 0);
+}
+
+// Index of the preset named 'name', -1 if there is none
+static int FindPreset(tsf* f, const char* name)
+{
+	int i;
+	for (i = 0; i != tsf_get_presetcount(f); i++)
+		if (!strcmp(tsf_get_presetname(f, i), name)) return i;
+	return -1;
+}
+
+// Key of the only fading voice, -1 if there is none or more than one
+static int FadingKey(tsf* f)
+{
+	int i, key = -1, num = 0;
+	for (i = 0; i != f->activeVoiceNum; i++)
+		if (f->voices[f->activeVoices[i]].fading) key = f->voices[f->activeVoices[i]].playingKey, num++;
+	return (num == 1 ? key : -1);
+}
+
+static void TestVoiceStealing(void)
+{
+	static const char* names[] = { "released", "quietest", "oldest", "same preset" };
+	static const int victims[] = { 64, 62, 60, 67 };
+	int policy, piano, accordion, pizzicato, violin, i, key;
+	char name[80];
+	tsf* f;
+
+	for (policy = TSF_STEAL_RELEASED; policy <= TSF_STEAL_SAME_PRESET; policy++)
+	{
+		sprintf(name, "voice stealing %s", names[policy]);
+		if ((f = Load(LOAD_FILENAME)) == TSF_NULL || !tsf_set_max_voices(f, 4)) { Fail(name, "load or setup error"); if (f) tsf_close(f); continue; }
+		tsf_set_voice_stealing(f, (enum TSFVoiceStealing)policy);
+		tsf_set_output(f, TSF_STEREO_INTERLEAVED, TEST_SAMPLERATE, -6.0f);
+		piano = FindPreset(f, "Piano");
+		accordion = FindPreset(f, "Accordion Fr");
+		pizzicato = FindPreset(f, "PizzicatoStr");
+		violin = FindPreset(f, "Violin");
+		if (piano < 0 || accordion < 0 || pizzicato < 0 || violin < 0) { Fail(name, "presets not found"); tsf_close(f); continue; }
+
+		// Four notes of presets with one region each, the oldest is an accordion, the pizzicato decays
+		// fastest, the violin is released (but still louder) and there is a piano, then another piano
+		// note needs a voice and each policy takes another one
+		tsf_note_on(f, accordion, 60, 1.0f); Render(f, 100);
+		tsf_note_on(f, pizzicato, 62, 1.0f); Render(f, 100);
+		tsf_note_on(f, violin, 64, 1.0f); Render(f, 100);
+		tsf_note_on(f, piano, 67, 1.0f); Render(f, 100);
+		tsf_note_off(f, violin, 64); Render(f, 1);
+		if (f->activeVoiceNum != 4 || f->playingVoiceNum != 4) { Fail(name, "notes not playing"); tsf_close(f); continue; }
+		tsf_note_on(f, piano, 72, 1.0f);
+
+		// The victim fades out in a voice of the reserve and is gone after the fast release
+		if ((key = FadingKey(f)) != victims[policy]) { printf("FAILED %-44s stole key %d instead of %d\n", name, key, victims[policy]); g_Failures++; }
+		else if (f->activeVoiceNum != 5 || f->playingVoiceNum != 4) Fail(name, "wrong number of voices playing");
+		else if (Render(f, 50), f->activeVoiceNum != 4 || f->playingVoiceNum != 4 || FadingKey(f) != -1) Fail(name, "victim still playing");
+		else printf("ok     %-44s key %d\n", name, key);
+		tsf_close(f);
+	}
+
+	// More notes at once than there are voices, the voices fading out are cut
+	f = Load(LOAD_FILENAME);
+	if (!f || !tsf_set_max_voices(f, 2)) { Fail("voice stealing many notes", "load or setup error"); if (f) tsf_close(f); return; }
+	tsf_set_output(f, TSF_STEREO_INTERLEAVED, TEST_SAMPLERATE, -6.0f);
+	for (i = 0; i != 20; i++) tsf_note_on(f, 0, 40 + i, 1.0f);
+	if (f->activeVoiceNum > 2 + TSF_VOICE_FADE_RESERVE || f->playingVoiceNum != 2) Fail("voice stealing many notes", "wrong number of voices playing");
+	else if (Render(f, 50), f->activeVoiceNum != 2) Fail("voice stealing many notes", "fading voices still playing");
+	else printf("ok     %-44s 20 notes\n", "voice stealing many notes");
+	tsf_close(f);
+}
+
+int main(int argc, char *argv[])
+{
+	tsf* f;
+	FILE* file;
+	int i;
+	if (argc > 1) g_FileName = argv[1];
+
+	file = fopen(g_FileName, "rb");
+	if (file)
+	{
+		fseek(file, 0, SEEK_END);
+		g_FileSize = (int)ftell(file);
+		fseek(file, 0, SEEK_SET);
+		g_FileData = (char*)malloc(g_FileSize * 2 + 2);
+		g_FileDataOdd = g_FileData + ((g_FileSize + 1) | 1); // malloc returns an even address
+		if (g_FileData && fread(g_FileData, 1, g_FileSize, file) == (size_t)g_FileSize) memcpy(g_FileDataOdd, g_FileData, g_FileSize);
+		else g_FileSize = 0;
+		fclose(file);
+	}
+
+	// Render the reference with the default settings
+	f = Load(LOAD_FILENAME);
+	if (!f)
+	{
+		fprintf(stderr, "Could not load SoundFont %s\n", g_FileName);
+		return 1;
+	}
+	Play(f, g_Reference, 0);
+	tsf_close(f);
+	for (i = 0; i != TEST_FRAMES * 2 && !g_Reference[i]; i++) {}
+	if (i == TEST_FRAMES * 2)
+	{
+		fprintf(stderr, "SoundFont %s plays no sound\n", g_FileName);
+		return 1;
+	}
+
+	f = Load(LOAD_CACHED_STREAM);
+	if (!f) Fail("load through cached stream", "load error");
+	else { Play(f, g_Output, 0); Check("load through cached stream", g_Output, g_Reference, 0); tsf_close(f); }
+
+	TestSampleCache();
+	TestStreaming();
+	TestPreloadSamples();
+	TestResident();
+	TestPreloadHydra();
+	TestPreloadPresets();
+	TestBank();
+	TestDecoder();
+	Test24Bit();
+	TestInterpolation();
+	TestLinearRuns();
+	TestRenderShort();
+	TestMaxVoices();
+	TestVoiceStealing();
+
+	free(g_FileData);
+	printf(g_Failures ? "%d tests FAILED\n" : "All tests passed\n", g_Failures);
+	return (g_Failures ? 1 : 0);
+}
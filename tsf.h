@@ -10,9 +10,14 @@
    #include "tsf.h"
 
    [OPTIONAL] #define TSF_NO_STDIO to remove stdio dependency
+   [OPTIONAL] #define TSF_NO_MMAP to remove tsf_load_mmap and its OS dependency
    [OPTIONAL] #define TSF_MALLOC, TSF_REALLOC, and TSF_FREE to avoid stdlib.h
    [OPTIONAL] #define TSF_MEMCPY, TSF_MEMSET to avoid string.h
-   [OPTIONAL] #define TSF_POW, TSF_POWF, TSF_EXPF, TSF_LOG, TSF_TAN, TSF_LOG10, TSF_SQRT to avoid math.h
+   [OPTIONAL] #define TSF_POW, TSF_POWF, TSF_EXPF, TSF_LOG, TSF_TAN, TSF_LOG10, TSF_SQRT, TSF_SIN, TSF_COS to avoid math.h
+   [OPTIONAL] #define TSF_BUFFS, TSF_BUFFSIZE to change the default sample cache size
+   [OPTIONAL] #define TSF_ATOMIC_LOAD, TSF_ATOMIC_STORE for acquire/release memory access on other compilers
+   [OPTIONAL] #define TSF_NO_SIMD to interpolate and mix voices with plain C instead of SSE2, AVX2 or NEON
+   [OPTIONAL] #define TSF_YIELD() to run code between voices in tsf_render_short_fast (yield() on Arduino by default)
 
    NOT YET IMPLEMENTED
      - Lower level voice interface to render single voices/presets
@@ -67,13 +72,22 @@ extern "C" {
 typedef struct tsf tsf;
 
 #ifndef TSF_NO_STDIO
-// Directly load a SoundFont from a .sf2 file path
+// Directly load a SoundFont from a .sf2 (or .sf3) file path
 TSFDEF tsf* tsf_load_filename(const char* filename);
 #endif
 
-// Load a SoundFont from a block of memory
+// Load a SoundFont (or a precompiled bank, see tsf_save_bank_memory) from a block of memory
+// The memory is referenced directly without copying so it needs to stay valid until tsf_close
 TSFDEF tsf* tsf_load_memory(const void* buffer, int size);
 
+#if !defined(TSF_NO_MMAP) && (defined(_WIN32) || defined(__unix__) || defined(__APPLE__))
+#define TSF_HAS_MMAP
+// Load a SoundFont by mapping a .sf2 file (or a precompiled bank) read-only into memory.
+// Sample data is played straight from the mapping without any copy or cache,
+// the operating system shares the pages between all processes using the same file.
+TSFDEF tsf* tsf_load_mmap(const char* filename);
+#endif
+
 // Stream structure for the generic loading
 struct tsf_stream
 {
@@ -111,6 +125,26 @@ TSFDEF int tsf_get_presetcount(tsf* f);
 // Returns the name of a preset index >= 0 and < tsf_get_presetcount()
 TSFDEF const char* tsf_get_presetname(tsf* f, int preset);
 
+// Returns 1 if the regions of a preset have been loaded (presets load on their first note otherwise)
+TSFDEF int tsf_get_presetloaded(tsf* f, int preset);
+
+// Load presets before playing them so their first note doesn't need to read and
+// allocate their data. If presets is NULL all presets are loaded, otherwise 'num' preset indices.
+// Returns 0 if the memory could not be allocated for all of them.
+TSFDEF int tsf_preload_presets(tsf* f, const int* presets, int num);
+
+// Queue presets to be loaded on another thread by tsf_stream_service, results are published
+// atomically so rendering and playing other presets can continue meanwhile.
+// Notes played on a preset that is still queued are ignored, use tsf_get_presetloaded to wait.
+// This needs to be called under the same lock as tsf_note_on. It reads the preset headers
+// into memory first (see tsf_preload_hydra) so the other thread doesn't use the stream.
+// Returns the number of queued presets or -1 if the preset headers could not be loaded.
+TSFDEF int tsf_preload_presets_async(tsf* f, const int* presets, int num);
+
+// Returns the preset index from a bank and preset number, or -1 if it does not exist
+// Preset indices are sorted by bank and preset number so this is a binary search.
+TSFDEF int tsf_get_presetindex(const tsf* f, int bank, int preset_number);
+
 // Supported output modes by the render methods
 enum TSFOutputMode
 {
@@ -134,6 +168,48 @@ enum TSFOutputMode
 //   globalgaindb: volume gain in decibels (>0 means higher, <0 means lower)
 TSFDEF void tsf_set_output(tsf* f, enum TSFOutputMode outputmode, int samplerate, float globalgaindb CPP_DEFAULT0);
 
+// Interpolation of sample data played at a different pitch, from fastest to highest quality
+enum TSFInterpolation
+{
+	// Take the nearest sample (cheapest but noisy)
+	TSF_INTERPOLATION_NEAREST,
+	// Linear interpolation between two samples (default)
+	TSF_INTERPOLATION_LINEAR,
+	// 4-point cubic Hermite interpolation
+	TSF_INTERPOLATION_HERMITE,
+	// Windowed sinc with 8 or 16 taps from a precomputed polyphase table (least aliasing)
+	TSF_INTERPOLATION_SINC8,
+	TSF_INTERPOLATION_SINC16
+};
+
+// Set the interpolation used by tsf_render_float and tsf_render_short
+// Returns 0 if the interpolation is unknown or the sinc table could not be allocated (the setting is unchanged then).
+TSFDEF int tsf_set_interpolation(tsf* f, enum TSFInterpolation interpolation);
+
+// Allocate a fixed pool of voices so tsf_note_on never allocates memory (by default the pool grows as needed)
+// Depending on the soundfont one note can play multiple voices, so don't set this too low.
+// When all voices are playing a new voice steals one chosen by tsf_set_voice_stealing which
+// then fades out quickly in one of TSF_VOICE_FADE_RESERVE extra voices.
+// Setting it to 0 returns to the growing pool. This stops all playing voices.
+// Returns 0 if the memory could not be allocated, the previous pool is kept then.
+TSFDEF int tsf_set_max_voices(tsf* f, int max_voices);
+
+// Which voice a new note takes over when the voice limit set by tsf_set_max_voices is reached
+enum TSFVoiceStealing
+{
+	// Voices in their release first, then the quietest (default)
+	TSF_STEAL_RELEASED,
+	// The quietest voice
+	TSF_STEAL_QUIETEST,
+	// The voice that started playing first
+	TSF_STEAL_OLDEST,
+	// Voices of the same preset first (the same key is always cut by a new note), then like TSF_STEAL_RELEASED
+	TSF_STEAL_SAME_PRESET
+};
+
+// Set the policy for choosing the voice to steal
+TSFDEF void tsf_set_voice_stealing(tsf* f, enum TSFVoiceStealing policy);
+
 // Start playing a note
 //   preset: preset index >= 0 and < tsf_get_presetcount()
 //   key: note value between 0 and 127 (60 being middle C)
@@ -146,12 +222,115 @@ TSFDEF void tsf_note_off(tsf* f, int preset, int key);
 // Render output samples into a buffer
 // You can either render as signed 16-bit values (tsf_render_short) or
 // as 32-bit float values (tsf_render_float)
+// tsf_render_short renders floats and converts them so it plays exactly like tsf_render_float,
+// with an FPU this is also faster than the integer rendering of tsf_render_short_fast.
 //   buffer: target buffer of size samples * output_channels * sizeof(type)
 //   samples: number of samples to render
 //   flag_mixing: if 0 clear the buffer first, otherwise mix into existing data
 TSFDEF void tsf_render_short(tsf* f, short* buffer, int samples, int flag_mixing CPP_DEFAULT0);
 TSFDEF void tsf_render_float(tsf* f, float* buffer, int samples, int flag_mixing CPP_DEFAULT0);
 
+// Render signed 16-bit output with integer math only for each sample (for CPUs without an FPU)
+// The result closely matches tsf_render_short, voices are added to the buffer with saturation.
+TSFDEF void tsf_render_short_fast(tsf* f, short* buffer, int samples, int flag_mixing CPP_DEFAULT0);
+
+// Sample data is read from the stream on demand through a cache of blocks.
+// Set the number of cache blocks and the number of samples in each block
+// (by default TSF_BUFFS and TSF_BUFFSIZE). This empties the cache.
+// Returns 0 if the memory could not be allocated, the previous cache is kept then.
+// Also returns 0 while streaming and if the samples are in memory (loaded from memory,
+// mapped or preloaded) as they are played without a cache.
+TSFDEF int tsf_set_sample_cache(tsf* f, int blocks, int blockSize);
+
+// Counters of the sample cache of a tsf instance (these wrap around on overflow)
+struct tsf_cache_stats
+{
+	// Block lookups that were found in the cache
+	unsigned int hits;
+
+	// Block lookups that needed to read from the stream
+	unsigned int misses;
+
+	// Misses that replaced a block which was previously in use
+	unsigned int evictions;
+
+	// Number of bytes read from the stream to fill cache blocks
+	unsigned int bytesRead;
+
+	// Block lookups in streaming mode that found the block not yet loaded
+	// (these samples played back as silence)
+	unsigned int underruns;
+};
+
+// Get the sample cache counters, if flag_reset is set they are set to zero afterwards
+TSFDEF void tsf_get_cache_stats(tsf* f, struct tsf_cache_stats* stats, int flag_reset CPP_DEFAULT0);
+
+// Streaming mode:
+// With streaming enabled the render and note functions never read from the stream.
+// Missing cache blocks are put into a lock-free queue and loaded by tsf_stream_service
+// which needs to be called regularly from a single other thread (i.e. a dedicated I/O thread).
+// Until a block is loaded it plays back as silence which is counted as an underrun.
+// Enabling streaming loads all presets (the preset data is read from the stream as well).
+// Enable before starting the I/O thread and disable only after it has stopped.
+// Changing the sample cache with tsf_set_sample_cache is not allowed while streaming.
+TSFDEF void tsf_set_streaming(tsf* f, int flag_enable);
+
+// Load the cache blocks requested by the render thread and the presets queued with
+// tsf_preload_presets_async, returns the number of loaded blocks and presets.
+TSFDEF int tsf_stream_service(tsf* f);
+
+// Read all preset, instrument and sample headers into memory at once (one read per list)
+// so loading presets on first use doesn't need to access the stream anymore.
+// Returns 0 if the memory could not be allocated or if streaming mode is active.
+TSFDEF int tsf_preload_hydra(tsf* f);
+
+// Read all sample data into memory at once and render from there without the sample cache.
+// This is the fastest option if there is enough memory for the full sample data.
+// Returns 0 if the memory could not be allocated or if streaming mode is active.
+TSFDEF int tsf_preload_samples(tsf* f);
+
+// Decoder for compressed samples (SF3 files store each sample as a separate Ogg Vorbis stream)
+struct tsf_sample_decoder
+{
+	// Custom data given to the functions as the first parameter
+	void* data;
+
+	// Function pointer will be called to start decoding a compressed sample of 'size' bytes
+	// (the data stays valid until close), returns a handle for decode and close or NULL on error
+	void* (*open)(void* data, const void* compressed, unsigned int size);
+
+	// Function pointer will be called to decode 'count' mono samples starting at sample 'pos' into 'out',
+	// returns the number of decoded samples. Consecutive calls mostly continue where the last one ended.
+	int (*decode)(void* data, void* handle, unsigned int pos, short* out, unsigned int count);
+
+	// Function pointer will be called to free a handle returned by open
+	void (*close)(void* data, void* handle);
+};
+
+// Set the decoder for compressed samples (or NULL to remove it), call this before playing any notes.
+// If stb_vorbis.c is included before the implementation of this library it is used by default,
+// without a decoder compressed samples play back as silence.
+// Compressed samples are decoded when their cache blocks are loaded (or by tsf_preload_samples)
+// so only the samples that are played cost decoding time and memory.
+// Not allowed while streaming mode is active.
+TSFDEF void tsf_set_sample_decoder(tsf* f, const struct tsf_sample_decoder* decoder);
+
+// Precompiled banks:
+// A bank file stores a loaded SoundFont with all presets already resolved into regions
+// (envelopes converted to seconds, presets sorted) followed by the sample data.
+// Loading one with tsf_load_memory or tsf_load_mmap just references the data in place
+// without parsing or converting anything. Bank files depend on the version of this
+// library and the byte order of the machine, the load functions return NULL otherwise.
+
+// Write a bank into a buffer, returns the size of the bank (pass NULL to only get the size)
+// or 0 if the buffer is too small, some data could not be loaded or streaming mode is active.
+TSFDEF int tsf_save_bank_memory(tsf* f, void* buffer, int size);
+
+#ifndef TSF_NO_STDIO
+// Write a bank to a file, returns 0 on error
+TSFDEF int tsf_save_bank_filename(tsf* f, const char* filename);
+#endif
+
 #ifdef __cplusplus
 #  undef CPP_DEFAULT0
 }
@@ -165,13 +344,61 @@ TSFDEF void tsf_render_float(tsf* f, float* buffer, int samples, int flag_mixing
 
 // The lower this block size is the more accurate the effects are.
 // Increasing the value significantly lowers the CPU usage of the voice rendering.
-// If LFO affects the low-pass filter it can be hearable even as low as 8.
+// The volume is ramped smoothly over each block but pitch and filter changes are not,
+// so if LFO affects the low-pass filter it can be hearable even as low as 8.
 #ifndef TSF_RENDER_EFFECTSAMPLEBLOCK
 #define TSF_RENDER_EFFECTSAMPLEBLOCK 64
 #endif
 
+// Number of samples tsf_render_short renders at a time into a float buffer before converting them.
+// The buffer is part of the tsf struct and takes 8 bytes per sample (4 KB by default), with fewer
+// samples per call the voices take turns more often and a sample cache smaller than the number
+// of playing voices is reloaded more often. Keep it a multiple of TSF_RENDER_EFFECTSAMPLEBLOCK so
+// the effect updates happen at the same samples as when rendering all samples at once.
+#ifndef TSF_RENDER_SHORTBLOCK
+#define TSF_RENDER_SHORTBLOCK (TSF_RENDER_EFFECTSAMPLEBLOCK * 8)
+#endif
+
+// Number of source samples each voice makes sure are in the sample cache ahead of
+// the samples needed for the block being rendered.
+#ifndef TSF_PREFETCH_SAMPLES
+#define TSF_PREFETCH_SAMPLES 256
+#endif
+
+#if !defined(TSF_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#  include <emmintrin.h>
+#  define TSF_SSE2
+#  if defined(__AVX2__)
+#    include <immintrin.h>
+#    define TSF_AVX2
+#  endif
+#elif !defined(TSF_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#  include <arm_neon.h>
+#  define TSF_NEON
+#endif
+
+// Number of fractional positions in the polyphase table of the sinc interpolation
+#define TSF_SINC_PHASES 256
+
+// Called after each voice rendered by tsf_render_short_fast to let cooperative schedulers run other tasks
+#ifndef TSF_YIELD
+#  ifdef ARDUINO
+#    define TSF_YIELD() yield()
+#  else
+#    define TSF_YIELD()
+#  endif
+#endif
+
 // Grace release time for quick voice off (avoid clicking noise)
 #define TSF_FASTRELEASETIME 0.01f
+
+// Number of lists of playing voices by exclusive class (voices of different classes can share a list)
+#define TSF_VOICE_GROUP_BUCKETS 32
+
+// Number of voices added to a fixed voice pool where stolen voices can fade out
+#ifndef TSF_VOICE_FADE_RESERVE
+#define TSF_VOICE_FADE_RESERVE 4
+#endif
 #if !defined(TSF_MALLOC) || !defined(TSF_FREE) || !defined(TSF_REALLOC)
 #  include <stdlib.h>
 #  define TSF_MALLOC  malloc
@@ -199,11 +426,44 @@ TSFDEF void tsf_render_float(tsf* f, float* buffer, int samples, int flag_mixing
 #  define TSF_LOG10   log10
 #  define TSF_SQRT    sqrt
 #endif
+#if !defined(TSF_SIN) || !defined(TSF_COS)
+#  include <math.h>
+#  define TSF_SIN     sin
+#  define TSF_COS     cos
+#endif
 
 #ifndef TSF_NO_STDIO
 #  include <stdio.h>
 #endif
 
+#ifdef TSF_HAS_MMAP
+#  ifdef _WIN32
+#    ifndef WIN32_LEAN_AND_MEAN
+#      define WIN32_LEAN_AND_MEAN
+#    endif
+#    ifndef NOMINMAX
+#      define NOMINMAX
+#    endif
+#    include <windows.h>
+#  else
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <fcntl.h>
+#    include <unistd.h>
+#  endif
+#endif
+
+// Used for the streaming mode queue between the render thread and the I/O thread
+#if !defined(TSF_ATOMIC_LOAD) || !defined(TSF_ATOMIC_STORE)
+#  if defined(__GNUC__) || defined(__clang__)
+#    define TSF_ATOMIC_LOAD(ptr)       __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#    define TSF_ATOMIC_STORE(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#  else // volatile access has acquire/release semantics with MSVC (/volatile:ms)
+#    define TSF_ATOMIC_LOAD(ptr)       (*(volatile int*)(ptr))
+#    define TSF_ATOMIC_STORE(ptr, val) (*(volatile int*)(ptr) = (val))
+#  endif
+#endif
+
 #define TSF_TRUE 1
 #define TSF_FALSE 0
 #define TSF_BOOL char
@@ -224,9 +484,34 @@ typedef char tsf_char20[20];
 
 #define TSF_FourCCEquals(value1, value2) (value1[0] == value2[0] && value1[1] == value2[1] && value1[2] == value2[2] && value1[3] == value2[3])
 
-// Samples cache, number and sample count
+// Default samples cache, number of blocks and samples per block (see tsf_set_sample_cache)
+#ifndef TSF_BUFFS
 #define TSF_BUFFS 16
+#endif
+#ifndef TSF_BUFFSIZE
 #define TSF_BUFFSIZE 512
+#endif
+
+// Number of silent samples after the sample data in memory, so interpolation can read past the end
+#define TSF_SAMPLEPADDING 16
+
+// Cached sample read, blocks are found through a hash table on (pos / blockSize)
+// and replaced with the CLOCK (second chance) policy.
+// In streaming mode the render thread queues block loads in the single producer single
+// consumer ring 'requests' and the I/O thread marks them as loaded in 'ready'.
+struct tsf_stream_request { int block, offset; };
+struct tsf_sample_cache
+{
+	short *data, *silence;
+	unsigned char *data24, *silence24; // low bytes of 24-bit samples (if used)
+	int *offset, *next, *hashHead, *ready;
+	TSF_BOOL *referenced;
+	int blocks, blockSize, hashMask, clockHand;
+	struct tsf_stream_request* requests;
+	int requestNum, requestHead, requestTail;
+	TSF_BOOL streaming;
+	struct tsf_cache_stats stats;
+};
 
 struct tsf
 {
@@ -236,23 +521,52 @@ struct tsf
 	int fontSamplesOffset;
 	int fontSampleCount;
 
+	// Low bytes of 24-bit samples (sm24 chunk) if the SoundFont has them, otherwise 0
+	int fontSamples24Offset;
+
+	// Sample data in memory (if not NULL the sample cache is not used)
+	const short* fontSamples;
+	const unsigned char* fontSamples24;
+	void* fontSamplesAlloc;
+	int fontSamplesAvail;
+
+	// Compressed samples sorted by their sample header index, they are decoded into the
+	// sample positions after the raw sample data (up to fontSampleCount)
+	struct tsf_compressed_sample* compressed;
+	int compressedNum;
+	struct tsf_sample_decoder decoder;
+
+	// Regions of all presets of a precompiled bank (if not NULL the presets don't own their regions)
+	const struct tsf_region* bankRegions;
+	void* bankRegionsAlloc;
+
 	struct tsf_voice *voices;
-	int voiceNum;
+	int voiceNum, maxVoiceNum;
+	int *activeVoices, *freeVoices; // indices of the playing voices and a stack of the unused ones
+	int activeVoiceNum, freeVoiceNum;
+	int playingVoiceNum; // active voices that are not fading, limited by maxVoiceNum
+	int keyVoices[128], groupVoices[TSF_VOICE_GROUP_BUCKETS]; // first voice of each list (index + 1, 0 if empty)
+	enum TSFVoiceStealing voiceStealing;
+	unsigned int voicePlayIndex;
 
 	float outSampleRate;
 	enum TSFOutputMode outputmode;
 	float globalGainDB;
+	float shortSamples[TSF_RENDER_SHORTBLOCK * 2]; // float samples converted by tsf_render_short
+
+	enum TSFInterpolation interpolation;
+	float* sincTable; // TSF_SINC_PHASES rows of 'sincTaps' coefficients
+	int32_t* sincTableFixed; // the same coefficients in Q30 (allocated together with sincTable)
+	int sincTaps;
 
-	float* outputSamples;
-	int outputSampleSize;
 
 	struct tsf_hydra *hydra;
 
-	// Cached sample read 
-	short *buffer[TSF_BUFFS];
-	int offset[TSF_BUFFS];
-	int timestamp[TSF_BUFFS];
-	int epoch;
+	// Presets queued by tsf_preload_presets_async (single producer single consumer ring)
+	int* presetRequests;
+	int presetRequestHead, presetRequestTail;
+
+	struct tsf_sample_cache cache;
 };
 
 struct tsf_stream_cached_data {
@@ -422,24 +736,105 @@ static int tsf_stream_memory_tell(struct tsf_stream_memory* m) { return m->pos;
 static int tsf_stream_memory_size(struct tsf_stream_memory* m) { return m->total; }
 static int tsf_stream_memory_skip(struct tsf_stream_memory* m, unsigned int count) { if (m->pos + count > m->total) return 0; m->pos += count; return 1; }
 static int tsf_stream_memory_seek(struct tsf_stream_memory* m, unsigned int pos) { if (pos > m->total) return 0; else m->pos = pos; return 1; }
-static int tsf_stream_memory_close(struct tsf_stream_memory* m) { (void)m; return 1; }
+static int tsf_stream_memory_close(struct tsf_stream_memory* m) { TSF_FREE(m); return 1; }
+static tsf* tsf_load_resident(struct tsf_stream* stream, const char* buffer, unsigned int size);
 TSFDEF tsf* tsf_load_memory(const void* buffer, int size)
 {
+	tsf* res;
 	struct tsf_stream stream = { TSF_NULL, (int(*)(void*,void*,unsigned int))&tsf_stream_memory_read, (int(*)(void*))&tsf_stream_memory_tell, (int(*)(void*,unsigned int))&tsf_stream_memory_skip, (int(*)(void*,unsigned int))&tsf_stream_memory_seek, (int(*)(void*))&tsf_stream_memory_close, (int(*)(void*))&tsf_stream_memory_size };
-	struct tsf_stream_memory f = { 0, 0, 0 };
-	f.buffer = (const char*)buffer;
-	f.total = size;
-	stream.data = &f;
-	return tsf_load(&stream);
+	// The stream is kept by the tsf instance so its data can't live on the stack
+	struct tsf_stream_memory* m = (struct tsf_stream_memory*)TSF_MALLOC(sizeof(struct tsf_stream_memory));
+	if (!m) return TSF_NULL;
+	m->buffer = (const char*)buffer;
+	m->total = size;
+	m->pos = 0;
+	stream.data = m;
+	res = tsf_load_resident(&stream, m->buffer, m->total);
+	if (!res) { TSF_FREE(m); return TSF_NULL; }
+	return res;
+}
+
+#ifdef TSF_HAS_MMAP
+struct tsf_stream_mmap
+{
+	struct tsf_stream_memory memory;
+	#ifdef _WIN32
+	HANDLE file, mapping;
+	#endif
+};
+static int tsf_stream_mmap_close(struct tsf_stream_mmap* m)
+{
+	#ifdef _WIN32
+	UnmapViewOfFile(m->memory.buffer);
+	CloseHandle(m->mapping);
+	CloseHandle(m->file);
+	#else
+	munmap((void*)m->memory.buffer, m->memory.total);
+	#endif
+	TSF_FREE(m);
+	return 1;
+}
+TSFDEF tsf* tsf_load_mmap(const char* filename)
+{
+	tsf* res;
+	struct tsf_stream stream = { TSF_NULL, (int(*)(void*,void*,unsigned int))&tsf_stream_memory_read, (int(*)(void*))&tsf_stream_memory_tell, (int(*)(void*,unsigned int))&tsf_stream_memory_skip, (int(*)(void*,unsigned int))&tsf_stream_memory_seek, (int(*)(void*))&tsf_stream_mmap_close, (int(*)(void*))&tsf_stream_memory_size };
+	struct tsf_stream_mmap* m = (struct tsf_stream_mmap*)TSF_MALLOC(sizeof(struct tsf_stream_mmap));
+	if (!m) return TSF_NULL;
+	TSF_MEMSET(m, 0, sizeof(*m));
+	#ifdef _WIN32
+	m->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, TSF_NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, TSF_NULL);
+	if (m->file == INVALID_HANDLE_VALUE) { TSF_FREE(m); return TSF_NULL; }
+	m->memory.total = GetFileSize(m->file, TSF_NULL);
+	m->mapping = CreateFileMappingA(m->file, TSF_NULL, PAGE_READONLY, 0, 0, TSF_NULL);
+	m->memory.buffer = (m->mapping ? (const char*)MapViewOfFile(m->mapping, FILE_MAP_READ, 0, 0, 0) : TSF_NULL);
+	if (!m->memory.buffer)
+	{
+		if (m->mapping) CloseHandle(m->mapping);
+		CloseHandle(m->file);
+		TSF_FREE(m);
+		return TSF_NULL;
+	}
+	#else
+	{
+		struct stat st;
+		void* map;
+		int fd = open(filename, O_RDONLY);
+		if (fd < 0) { TSF_FREE(m); return TSF_NULL; }
+		map = (fstat(fd, &st) == 0 && st.st_size > 0 ? mmap(TSF_NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED);
+		close(fd); // the mapping stays valid
+		if (map == MAP_FAILED) { TSF_FREE(m); return TSF_NULL; }
+		m->memory.buffer = (const char*)map;
+		m->memory.total = (unsigned int)st.st_size;
+	}
+	#endif
+	stream.data = m;
+	res = tsf_load_resident(&stream, m->memory.buffer, m->memory.total);
+	if (!res) { tsf_stream_mmap_close(m); return TSF_NULL; }
+	return res;
 }
+#endif
 
 enum { TSF_LOOPMODE_NONE, TSF_LOOPMODE_CONTINUOUS, TSF_LOOPMODE_SUSTAIN };
 
+enum { TSF_SAMPLETYPE_COMPRESSED = 0x10 };
+
+// A compressed sample with 'size' bytes at 'start' in the smpl chunk, decoded to 'length' samples at 'pos'
+struct tsf_compressed_sample
+{
+	int shdrIndex;
+	unsigned int start, size, pos, length;
+	void* handle; // opened by the decoder on first use
+	char* data; // compressed data read from the stream (if not in memory)
+};
+
 enum { TSF_SEGMENT_NONE, TSF_SEGMENT_DELAY, TSF_SEGMENT_ATTACK, TSF_SEGMENT_HOLD, TSF_SEGMENT_DECAY, TSF_SEGMENT_SUSTAIN, TSF_SEGMENT_RELEASE, TSF_SEGMENT_DONE };
 
 struct tsf_hydra
 {
 	struct tsf_stream *stream;
+	const char* memory; // if not NULL the records are read directly from here
+	struct tsf_hydra_phdr* phdrs; struct tsf_hydra_pbag* pbags; struct tsf_hydra_pgen* pgens; struct tsf_hydra_inst* insts;
+	struct tsf_hydra_ibag* ibags; struct tsf_hydra_igen* igens; struct tsf_hydra_shdr* shdrs; // records preloaded by tsf_preload_hydra
 	int phdrOffset, pbagOffset, pmodOffset, pgenOffset, instOffset, ibagOffset, imodOffset, igenOffset, shdrOffset;
 	int phdrNum, pbagNum, pmodNum, pgenNum, instNum, ibagNum, imodNum, igenNum, shdrNum;
 };
@@ -466,6 +861,15 @@ static void tsf_hydra_read_ibag(struct tsf_hydra_ibag* i, struct tsf_stream* str
 static void tsf_hydra_read_igen(struct tsf_hydra_igen* i, struct tsf_stream* stream) { TSFR(genOper) TSFR(genAmount) }
 static void tsf_hydra_read_shdr(struct tsf_hydra_shdr* i, struct tsf_stream* stream) { TSFR(sampleName) TSFR(start) TSFR(end) TSFR(startLoop) TSFR(endLoop) TSFR(sampleRate) TSFR(originalPitch) TSFR(pitchCorrection) TSFR(sampleLink) TSFR(sampleType) }
 #undef TSFR
+#define TSFM(FIELD) TSF_MEMCPY(&i->FIELD, p, sizeof(i->FIELD)); p += sizeof(i->FIELD);
+static void tsf_hydra_copy_phdr(struct tsf_hydra_phdr* i, const char* p) { TSFM(presetName) TSFM(preset) TSFM(bank) TSFM(presetBagNdx) TSFM(library) TSFM(genre) TSFM(morphology) }
+static void tsf_hydra_copy_pbag(struct tsf_hydra_pbag* i, const char* p) { TSFM(genNdx) TSFM(modNdx) }
+static void tsf_hydra_copy_pgen(struct tsf_hydra_pgen* i, const char* p) { TSFM(genOper) TSFM(genAmount) }
+static void tsf_hydra_copy_inst(struct tsf_hydra_inst* i, const char* p) { TSFM(instName) TSFM(instBagNdx) }
+static void tsf_hydra_copy_ibag(struct tsf_hydra_ibag* i, const char* p) { TSFM(instGenNdx) TSFM(instModNdx) }
+static void tsf_hydra_copy_igen(struct tsf_hydra_igen* i, const char* p) { TSFM(genOper) TSFM(genAmount) }
+static void tsf_hydra_copy_shdr(struct tsf_hydra_shdr* i, const char* p) { TSFM(sampleName) TSFM(start) TSFM(end) TSFM(startLoop) TSFM(endLoop) TSFM(sampleRate) TSFM(originalPitch) TSFM(pitchCorrection) TSFM(sampleLink) TSFM(sampleType) }
+#undef TSFM
 enum
 {
 	phdrSizeInFile = 38, pbagSizeInFile =  4, pmodSizeInFile = 10,
@@ -476,6 +880,8 @@ enum
 #define TGET(TYPE) \
 static struct tsf_hydra_##TYPE *get_##TYPE(struct tsf_hydra *t, int idx, struct tsf_hydra_##TYPE *data) \
 { \
+	if (t->TYPE##s) { if (idx < t->TYPE##Num) *data = t->TYPE##s[idx]; else TSF_MEMSET(data, 0, sizeof(*data)); return data; } \
+	if (t->memory) { tsf_hydra_copy_##TYPE(data, t->memory + t->TYPE##Offset + TYPE##SizeInFile * idx); return data; } \
 	t->stream->seek(t->stream->data, t->TYPE##Offset + TYPE##SizeInFile * idx); \
 	tsf_hydra_read_##TYPE(data, t->stream); \
 	return data; \
@@ -492,6 +898,45 @@ TGET(igen)
 TGET(shdr)
 #undef TGET
 
+static void tsf_hydra_free_records(struct tsf_hydra *t)
+{
+	TSF_FREE(t->phdrs); TSF_FREE(t->pbags); TSF_FREE(t->pgens); TSF_FREE(t->insts); TSF_FREE(t->ibags); TSF_FREE(t->igens); TSF_FREE(t->shdrs);
+	t->phdrs = TSF_NULL; t->pbags = TSF_NULL; t->pgens = TSF_NULL; t->insts = TSF_NULL; t->ibags = TSF_NULL; t->igens = TSF_NULL; t->shdrs = TSF_NULL;
+}
+
+static TSF_BOOL tsf_hydra_preload_records(struct tsf_hydra *t)
+{
+	int maxSize = 1, i; // at least one byte, TSF_MALLOC(0) may return NULL
+	char* buf;
+	#define TSF_LISTSIZE(TYPE) if (t->TYPE##Num * TYPE##SizeInFile > maxSize) maxSize = t->TYPE##Num * TYPE##SizeInFile;
+	TSF_LISTSIZE(phdr) TSF_LISTSIZE(pbag) TSF_LISTSIZE(pgen) TSF_LISTSIZE(inst) TSF_LISTSIZE(ibag) TSF_LISTSIZE(igen) TSF_LISTSIZE(shdr)
+	#undef TSF_LISTSIZE
+	buf = (t->memory ? TSF_NULL : (char*)TSF_MALLOC(maxSize));
+	if (!buf && !t->memory) return TSF_FALSE;
+	// Empty lists still get a record allocated, a non-NULL list marks the records as preloaded
+	#define TSF_PRELOAD(TYPE) \
+		{ \
+			const char* p = buf; \
+			t->TYPE##s = (struct tsf_hydra_##TYPE*)TSF_MALLOC((t->TYPE##Num ? t->TYPE##Num : 1) * sizeof(struct tsf_hydra_##TYPE)); \
+			if (!t->TYPE##s) goto error; \
+			if (t->memory) p = t->memory + t->TYPE##Offset; \
+			else if (t->TYPE##Num) \
+			{ \
+				t->stream->seek(t->stream->data, t->TYPE##Offset); \
+				if (!t->stream->read(t->stream->data, buf, t->TYPE##Num * TYPE##SizeInFile)) goto error; \
+			} \
+			for (i = 0; i != t->TYPE##Num; i++, p += TYPE##SizeInFile) tsf_hydra_copy_##TYPE(&t->TYPE##s[i], p); \
+		}
+	TSF_PRELOAD(phdr) TSF_PRELOAD(pbag) TSF_PRELOAD(pgen) TSF_PRELOAD(inst) TSF_PRELOAD(ibag) TSF_PRELOAD(igen) TSF_PRELOAD(shdr)
+	#undef TSF_PRELOAD
+	TSF_FREE(buf);
+	return TSF_TRUE;
+error:
+	TSF_FREE(buf);
+	tsf_hydra_free_records(t);
+	return TSF_FALSE;
+}
+
 typedef int64_t fixed32p32;
 typedef int32_t fixed30p2;
 typedef int32_t fixed24p8;
@@ -504,6 +949,7 @@ struct tsf_riffchunk { tsf_fourcc id; tsf_u32 size; };
 struct tsf_envelope { float delay, start, attack, hold, decay, sustain, release, keynumToHold, keynumToDecay; };
 struct tsf_voice_envelope { float level, slope; int samplesUntilNextSegment; int segment; struct tsf_envelope parameters; TSF_BOOL segmentIsExponential, exponentialDecay; };
 struct tsf_voice_lowpass { double QInv, a0, a1, b1, b2, z1, z2; TSF_BOOL active; };
+struct tsf_voice_lowpass_fixed { int32_t a0, a1, b1, b2; int64_t z1, z2; };
 struct tsf_voice_lfo { int samplesUntil; float level, delta; };
 
 struct tsf_region
@@ -523,26 +969,37 @@ struct tsf_region
 	int freqVibLFO, vibLfoToPitch;
 };
 
+enum { TSF_PRESET_UNLOADED, TSF_PRESET_QUEUED, TSF_PRESET_LOADED };
+
 struct tsf_preset
 {
 	tsf_char20 presetName;
 	tsf_u16 preset, bank;
+	int phdrIndex, loadState;
 	struct tsf_region* regions;
 	int regionNum;
+	int* keyRegions; // 'keyRegions[key]' up to 'keyRegions[key + 1]' index the regions for a key sorted by lovel
 };
 
 struct tsf_voice
 {
 	int playingPreset, playingKey, curPitchWheel;
+	unsigned int playIndex;
+	int activeIndex; // position in f->activeVoices while playing
+	TSF_BOOL fading; // released in TSF_FASTRELEASETIME, not counted in f->playingVoiceNum
+	int keyPrev, keyNext, groupPrev, groupNext; // neighbors in the lists of the same key and exclusive group (index + 1, 0 if none)
 	struct tsf_region* region;
 	double pitchInputTimecents, pitchOutputFactor;
 	double sourceSamplePosition;
-  fixed32p32 sourceSamplePositionF32P32;
 	float  noteGainDB, panFactorLeft, panFactorRight;
 	unsigned int sampleEnd, loopStart, loopEnd;
 	struct tsf_voice_envelope ampenv, modenv;
 	struct tsf_voice_lowpass lowpass;
 	struct tsf_voice_lfo modlfo, viblfo;
+	// State of tsf_render_short_fast, while 'fixedState' is set the position and filter state are only kept here
+	fixed32p32 sourceSamplePositionFixed, pitchRatioFixed;
+	struct tsf_voice_lowpass_fixed lowpassFixed;
+	TSF_BOOL fixedState;
 };
 
 static double tsf_timecents2Secsd(double timecents) { return TSF_POW(2.0, timecents / 1200.0); }
@@ -556,6 +1013,9 @@ static TSF_BOOL tsf_riffchunk_read(struct tsf_riffchunk* parent, struct tsf_riff
 	if (parent && sizeof(tsf_fourcc) + sizeof(tsf_u32) > parent->size) return TSF_FALSE;
 	if (!stream->read(stream->data, &chunk->id, sizeof(tsf_fourcc)) || *chunk->id <= ' ' || *chunk->id >= 'z') return TSF_FALSE;
 	if (!stream->read(stream->data, &chunk->size, sizeof(tsf_u32))) return TSF_FALSE;
+	// Chunks are padded to an even size (the compressed sample data of SF3 files can have any size),
+	// a missing pad byte at the end of the parent is tolerated
+	if ((chunk->size & 1) && (!parent || sizeof(tsf_fourcc) + sizeof(tsf_u32) + chunk->size < parent->size)) chunk->size++;
 	if (parent && sizeof(tsf_fourcc) + sizeof(tsf_u32) + chunk->size > parent->size) return TSF_FALSE;
 	if (parent) parent->size -= sizeof(tsf_fourcc) + sizeof(tsf_u32) + chunk->size;
 	IsRiff = TSF_FourCCEquals(chunk->id, "RIFF"), IsList = TSF_FourCCEquals(chunk->id, "LIST");
@@ -671,32 +1131,115 @@ static void tsf_region_envtosecs(struct tsf_envelope* p, TSF_BOOL sustainIsGain)
 	else p->sustain = p->sustain / 10.0f;
 }
 
-static void tsf_load_preset(tsf* res, struct tsf_hydra *hydra, int presetToLoad)
+static TSF_BOOL tsf_preset_less(const struct tsf_preset* a, const struct tsf_preset* b)
+{
+	return (a->bank != b->bank ? a->bank < b->bank : (a->preset != b->preset ? a->preset < b->preset : a->phdrIndex < b->phdrIndex));
+}
+
+// Read the name, bank and preset number of all presets and sort them by bank and preset number
+static void tsf_load_presetindex(tsf* res, struct tsf_hydra *hydra)
 {
-	enum { GenInstrument = 41, GenSampleID = 53 };
-	// Read each preset.
 	struct tsf_hydra_phdr phdr;
-	int phdrIdx, phdrMaxIdx;
-	for (phdrIdx = presetToLoad, get_phdr(hydra, phdrIdx, &phdr), phdrMaxIdx = presetToLoad + 1 /*hydra->phdrNum - 1*/; phdrIdx != phdrMaxIdx; phdrIdx++, get_phdr(hydra, phdrIdx, &phdr))
+	struct tsf_preset *tmp, *src, *dst, *swap;
+	int i, j, width, n = res->presetNum;
+	for (i = 0; i != n; i++)
 	{
-		int sortedIndex = 0, region_index = 0;
-		struct tsf_hydra_phdr otherPhdr;
-		int otherPhdrIdx;
-		struct tsf_preset* preset;
-		for (otherPhdrIdx = 0, get_phdr(hydra, otherPhdrIdx, &otherPhdr); otherPhdrIdx != phdrMaxIdx; otherPhdrIdx++, get_phdr(hydra, otherPhdrIdx, &otherPhdr))
-		{
-			if (otherPhdrIdx == phdrIdx || otherPhdr.bank > phdr.bank) continue;
-			else if (otherPhdr.bank < phdr.bank) sortedIndex++;
-			else if (otherPhdr.preset > phdr.preset) continue;
-			else if (otherPhdr.preset < phdr.preset) sortedIndex++;
-			else if (otherPhdrIdx < phdrIdx) sortedIndex++;
-		}
-
-		preset = &res->presets[sortedIndex];
+		struct tsf_preset* preset = &res->presets[i];
+		get_phdr(hydra, i, &phdr);
 		TSF_MEMCPY(preset->presetName, phdr.presetName, sizeof(preset->presetName));
 		preset->presetName[sizeof(preset->presetName)-1] = '\0'; //should be zero terminated in source file but make sure
 		preset->bank = phdr.bank;
 		preset->preset = phdr.preset;
+		preset->phdrIndex = i;
+	}
+
+	// Bottom-up merge sort
+	tmp = (struct tsf_preset*)TSF_MALLOC(n * sizeof(struct tsf_preset));
+	if (!tmp)
+	{
+		// Fall back to an insertion sort in place so tsf_get_presetindex still works
+		for (i = 1; i < n; i++)
+		{
+			struct tsf_preset preset = res->presets[i];
+			for (j = i; j && tsf_preset_less(&preset, &res->presets[j - 1]); j--) res->presets[j] = res->presets[j - 1];
+			res->presets[j] = preset;
+		}
+		return;
+	}
+	for (src = res->presets, dst = tmp, width = 1; width < n; width *= 2, swap = src, src = dst, dst = swap)
+	{
+		for (i = 0; i < n; i += 2 * width)
+		{
+			int l = i, lEnd = (i + width < n ? i + width : n), r = lEnd, rEnd = (i + 2 * width < n ? i + 2 * width : n), o = i;
+			while (l < lEnd && r < rEnd) dst[o++] = (tsf_preset_less(&src[r], &src[l]) ? src[r++] : src[l++]);
+			while (l < lEnd) dst[o++] = src[l++];
+			while (r < rEnd) dst[o++] = src[r++];
+		}
+	}
+	if (src != res->presets) TSF_MEMCPY(res->presets, src, n * sizeof(struct tsf_preset));
+	TSF_FREE(tmp);
+}
+
+static struct tsf_compressed_sample* tsf_find_compressed(tsf* f, int shdrIndex)
+{
+	int lo = 0, hi = f->compressedNum;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (f->compressed[mid].shdrIndex < shdrIndex) lo = mid + 1; else hi = mid;
+	}
+	return (lo < f->compressedNum && f->compressed[lo].shdrIndex == shdrIndex ? &f->compressed[lo] : TSF_NULL);
+}
+
+// Point the sample header of a compressed sample to its decoded sample positions
+// (loop points of compressed samples are relative to the start of the sample)
+static void tsf_compressed_shdr(tsf* f, int shdrIndex, struct tsf_hydra_shdr* shdr)
+{
+	struct tsf_compressed_sample* c = tsf_find_compressed(f, shdrIndex);
+	if (!c) { shdr->start = shdr->end = shdr->startLoop = shdr->endLoop = 0; return; }
+	shdr->start = c->pos;
+	shdr->end = c->pos + c->length;
+	if (shdr->endLoop > 0) { shdr->startLoop += c->pos; shdr->endLoop += c->pos; }
+}
+
+// Build the table of the regions playing for each key, ordered by their lowest velocity
+// so tsf_note_on can stop at the first region with a lovel above the velocity.
+static int tsf_preset_keymap(struct tsf_preset* preset)
+{
+	int key, i, j, num = 129, *map;
+	struct tsf_region *region, *regionEnd = preset->regions + preset->regionNum;
+	for (region = preset->regions; region != regionEnd; region++)
+		if (region->lokey <= region->hikey && region->lokey < 128)
+			num += (region->hikey < 128 ? region->hikey : 127) - region->lokey + 1;
+	map = (int*)TSF_MALLOC(num * sizeof(int));
+	if (!map) return 0;
+	for (key = 0, num = 129; key != 128; key++)
+	{
+		map[key] = num;
+		for (i = 0; i != preset->regionNum; i++)
+		{
+			if (key < preset->regions[i].lokey || key > preset->regions[i].hikey) continue;
+			// Insertion sort which keeps regions with the same lovel in their original order
+			for (j = num++; j != map[key] && preset->regions[map[j - 1]].lovel > preset->regions[i].lovel; j--) map[j] = map[j - 1];
+			map[j] = i;
+		}
+	}
+	map[128] = num;
+	TSF_FREE(preset->keyRegions);
+	preset->keyRegions = map;
+	return 1;
+}
+
+static int tsf_load_preset(tsf* res, struct tsf_hydra *hydra, int presetToLoad)
+{
+	enum { GenInstrument = 41, GenSampleID = 53 };
+	// Read each preset.
+	struct tsf_hydra_phdr phdr;
+	int phdrIdx, phdrMaxIdx;
+	for (phdrIdx = res->presets[presetToLoad].phdrIndex, get_phdr(hydra, phdrIdx, &phdr), phdrMaxIdx = phdrIdx + 1; phdrIdx != phdrMaxIdx; phdrIdx++, get_phdr(hydra, phdrIdx, &phdr))
+	{
+		int region_index = 0;
+		struct tsf_preset* preset = &res->presets[presetToLoad]; // name, bank and preset number are set by tsf_load_presetindex
 		preset->regionNum = 0;
 
 		struct tsf_hydra_phdr phdrNext;
@@ -734,6 +1277,7 @@ static void tsf_load_preset(tsf* res, struct tsf_hydra *hydra, int presetToLoad)
 		}
 
 		preset->regions = (struct tsf_region*)TSF_MALLOC(preset->regionNum * sizeof(struct tsf_region));
+		if (!preset->regions && preset->regionNum) { preset->regionNum = 0; return 0; }
 
 		// Zones.
 		//*** TODO: Handle global zone (modulators only).
@@ -835,6 +1379,7 @@ static void tsf_load_preset(tsf* res, struct tsf_hydra *hydra, int presetToLoad)
 								else if (zoneRegion.pan > 100.0f) zoneRegion.pan = 100.0f;
 								if (zoneRegion.initialFilterQ < 1500 || zoneRegion.initialFilterQ > 13500) zoneRegion.initialFilterQ = 0;
 
+								if (shdr.sampleType & TSF_SAMPLETYPE_COMPRESSED) tsf_compressed_shdr(res, igen.genAmount.wordAmount, &shdr);
 								zoneRegion.offset += shdr.start;
 								zoneRegion.end += shdr.end;
 								zoneRegion.loop_start += shdr.startLoop;
@@ -873,15 +1418,108 @@ static void tsf_load_preset(tsf* res, struct tsf_hydra *hydra, int presetToLoad)
 			//if (pbag->modNdx < pbag[1].modNdx) addUnsupportedOpcode("any modulator");
 		}
 	}
+	return tsf_preset_keymap(&res->presets[presetToLoad]);
 }
 
 static void tsf_load_samples(int *fontSamplesOffset, int* fontSampleCount, struct tsf_riffchunk *chunkSmpl, struct tsf_stream* stream)
 {
-	// Read sample data into float format buffer.
-	unsigned int samplesLeft;
-	samplesLeft = *fontSampleCount = chunkSmpl->size / sizeof(short);
+	// Sample data is read on demand, remember where it is
+	*fontSampleCount = chunkSmpl->size / sizeof(short);
 	*fontSamplesOffset = stream->tell(stream->data);
-	stream->skip(stream->data, samplesLeft * sizeof(short));
+	stream->skip(stream->data, chunkSmpl->size);
+}
+
+#ifdef STB_VORBIS_INCLUDE_STB_VORBIS_H
+struct tsf_stb_vorbis { stb_vorbis* v; unsigned int pos; };
+
+static void* tsf_stb_vorbis_open(void* data, const void* compressed, unsigned int size)
+{
+	struct tsf_stb_vorbis* s = (struct tsf_stb_vorbis*)TSF_MALLOC(sizeof(struct tsf_stb_vorbis));
+	int error;
+	(void)data;
+	if (!s) return TSF_NULL;
+	s->v = stb_vorbis_open_memory((const unsigned char*)compressed, (int)size, &error, TSF_NULL);
+	s->pos = 0;
+	if (!s->v) { TSF_FREE(s); return TSF_NULL; }
+	return s;
+}
+
+static int tsf_stb_vorbis_decode(void* data, void* handle, unsigned int pos, short* out, unsigned int count)
+{
+	struct tsf_stb_vorbis* s = (struct tsf_stb_vorbis*)handle;
+	int n;
+	unsigned int decoded = 0;
+	(void)data;
+	if (pos != s->pos && !stb_vorbis_seek(s->v, pos)) return 0;
+	while (decoded < count && (n = stb_vorbis_get_samples_short_interleaved(s->v, 1, out + decoded, (int)(count - decoded))) > 0) decoded += n;
+	s->pos = pos + decoded;
+	return (int)decoded;
+}
+
+static void tsf_stb_vorbis_close(void* data, void* handle)
+{
+	(void)data;
+	stb_vorbis_close(((struct tsf_stb_vorbis*)handle)->v);
+	TSF_FREE(handle);
+}
+#endif
+
+// Returns the number of samples of an Ogg stream from the granule position of its last page
+static unsigned int tsf_ogg_length(struct tsf_stream* stream, unsigned int offset, unsigned int size)
+{
+	unsigned char tail[1024], *buf = tail;
+	unsigned int n = (size < sizeof(tail) ? size : sizeof(tail)), i, res = 0;
+	for (;;)
+	{
+		stream->seek(stream->data, offset + size - n);
+		if (!stream->read(stream->data, buf, n)) break;
+		for (i = n; i-- > 0;)
+			if (i + 27 <= n && buf[i] == 'O' && buf[i + 1] == 'g' && buf[i + 2] == 'g' && buf[i + 3] == 'S' && (buf[i + 5] & 4))
+				{ res = buf[i + 6] | (buf[i + 7] << 8) | (buf[i + 8] << 16) | ((unsigned int)buf[i + 9] << 24); break; }
+		// Pages can be up to 65307 bytes, retry with the largest possible last page
+		if (res || n == size || buf != tail) break;
+		n = (size < 65536 ? size : 65536);
+		if (!(buf = (unsigned char*)TSF_MALLOC(n))) return 0;
+	}
+	if (buf != tail) TSF_FREE(buf);
+	return res;
+}
+
+// Find the compressed samples of an SF3 file and place their decoded samples after the raw
+// sample data, with 46 zero samples after each like the sample data of SF2 files
+static TSF_BOOL tsf_load_compressed(tsf* res)
+{
+	struct tsf_hydra_shdr shdr;
+	unsigned int pos = res->fontSampleCount, rawSize = res->fontSampleCount * sizeof(short);
+	int i, n;
+	for (i = 0, n = 0; i < res->hydra->shdrNum; i++)
+		if (get_shdr(res->hydra, i, &shdr)->sampleType & TSF_SAMPLETYPE_COMPRESSED) n++;
+	if (!n) return TSF_TRUE;
+	res->compressed = (struct tsf_compressed_sample*)TSF_MALLOC(n * sizeof(struct tsf_compressed_sample));
+	if (!res->compressed) return TSF_FALSE;
+	for (i = 0, n = 0; i < res->hydra->shdrNum; i++)
+	{
+		struct tsf_compressed_sample* c;
+		if (!(get_shdr(res->hydra, i, &shdr)->sampleType & TSF_SAMPLETYPE_COMPRESSED)) continue;
+		c = &res->compressed[n++];
+		c->shdrIndex = i;
+		c->start = shdr.start;
+		c->size = (shdr.start < shdr.end && shdr.end <= rawSize ? shdr.end - shdr.start : 0);
+		c->length = (c->size ? tsf_ogg_length(res->hydra->stream, res->fontSamplesOffset + c->start, c->size) : 0);
+		c->pos = pos;
+		c->handle = TSF_NULL;
+		c->data = TSF_NULL;
+		pos += c->length + 46;
+	}
+	res->compressedNum = n;
+	res->fontSampleCount = pos;
+	res->fontSamples24Offset = 0; // sm24 is not used with compressed samples
+	#ifdef STB_VORBIS_INCLUDE_STB_VORBIS_H
+	res->decoder.open = tsf_stb_vorbis_open;
+	res->decoder.decode = tsf_stb_vorbis_decode;
+	res->decoder.close = tsf_stb_vorbis_close;
+	#endif
+	return TSF_TRUE;
 }
 
 static void tsf_voice_envelope_nextsegment(struct tsf_voice_envelope* e, int active_segment, float outSampleRate)
@@ -1038,16 +1676,52 @@ static void tsf_voice_lfo_process(struct tsf_voice_lfo* e, int blockSamples)
 	else if (e->level < -1.0f) { e->delta = -e->delta; e->level = -2.0f - e->level; }
 }
 
-static void tsf_voice_kill(struct tsf_voice* v)
+// Add a playing voice to the lists of voices by key and exclusive group
+static void tsf_voice_link(tsf* f, struct tsf_voice* v)
+{
+	int index = (int)(v - f->voices) + 1, *head = &f->keyVoices[v->playingKey & 127];
+	v->keyPrev = 0;
+	v->keyNext = *head;
+	if (*head) f->voices[*head - 1].keyPrev = index;
+	*head = index;
+	if (!v->region->group) return;
+	head = &f->groupVoices[v->region->group % TSF_VOICE_GROUP_BUCKETS];
+	v->groupPrev = 0;
+	v->groupNext = *head;
+	if (*head) f->voices[*head - 1].groupPrev = index;
+	*head = index;
+}
+
+static void tsf_voice_unlink(tsf* f, struct tsf_voice* v)
 {
+	if (v->keyPrev) f->voices[v->keyPrev - 1].keyNext = v->keyNext;
+	else f->keyVoices[v->playingKey & 127] = v->keyNext;
+	if (v->keyNext) f->voices[v->keyNext - 1].keyPrev = v->keyPrev;
+	if (!v->region->group) return;
+	if (v->groupPrev) f->voices[v->groupPrev - 1].groupNext = v->groupNext;
+	else f->groupVoices[v->region->group % TSF_VOICE_GROUP_BUCKETS] = v->groupNext;
+	if (v->groupNext) f->voices[v->groupNext - 1].groupPrev = v->groupPrev;
+}
+
+static void tsf_voice_kill(tsf* f, struct tsf_voice* v)
+{
+	tsf_voice_unlink(f, v);
+
+	// Move the last playing voice into the place of this one
+	int last = f->activeVoices[--f->activeVoiceNum];
+	f->activeVoices[v->activeIndex] = last;
+	f->voices[last].activeIndex = v->activeIndex;
+	f->freeVoices[f->freeVoiceNum++] = (int)(v - f->voices);
+	if (!v->fading) f->playingVoiceNum--;
 	v->region = TSF_NULL;
 	v->playingPreset = -1;
 }
 
-static void tsf_voice_end(struct tsf_voice* v, float outSampleRate)
+static void tsf_voice_end(tsf* f, struct tsf_voice* v)
 {
-	tsf_voice_envelope_nextsegment(&v->ampenv, TSF_SEGMENT_SUSTAIN, outSampleRate);
-	tsf_voice_envelope_nextsegment(&v->modenv, TSF_SEGMENT_SUSTAIN, outSampleRate);
+	tsf_voice_envelope_nextsegment(&v->ampenv, TSF_SEGMENT_SUSTAIN, f->outSampleRate);
+	tsf_voice_envelope_nextsegment(&v->modenv, TSF_SEGMENT_SUSTAIN, f->outSampleRate);
+	if (v->ampenv.parameters.release <= 0 && !v->fading) { v->fading = TSF_TRUE; f->playingVoiceNum--; }
 	if (v->region->loop_mode == TSF_LOOPMODE_SUSTAIN)
 	{
 		// Continue playing, but stop looping.
@@ -1055,10 +1729,11 @@ static void tsf_voice_end(struct tsf_voice* v, float outSampleRate)
 	}
 }
 
-static void tsf_voice_endquick(struct tsf_voice* v, float outSampleRate)
+static void tsf_voice_endquick(tsf* f, struct tsf_voice* v)
 {
-	v->ampenv.parameters.release = 0.0f; tsf_voice_envelope_nextsegment(&v->ampenv, TSF_SEGMENT_SUSTAIN, outSampleRate);
-	v->modenv.parameters.release = 0.0f; tsf_voice_envelope_nextsegment(&v->modenv, TSF_SEGMENT_SUSTAIN, outSampleRate);
+	v->ampenv.parameters.release = 0.0f; tsf_voice_envelope_nextsegment(&v->ampenv, TSF_SEGMENT_SUSTAIN, f->outSampleRate);
+	v->modenv.parameters.release = 0.0f; tsf_voice_envelope_nextsegment(&v->modenv, TSF_SEGMENT_SUSTAIN, f->outSampleRate);
+	if (!v->fading) { v->fading = TSF_TRUE; f->playingVoiceNum--; }
 }
 
 static void tsf_voice_calcpitchratio(struct tsf_voice* v, float outSampleRate)
@@ -1072,98 +1747,482 @@ static void tsf_voice_calcpitchratio(struct tsf_voice* v, float outSampleRate)
 
 	v->pitchInputTimecents = adjustedPitch * 100.0;
 	v->pitchOutputFactor = v->region->sample_rate / (tsf_timecents2Secsd(v->region->pitch_keycenter * 100.0) * outSampleRate);
+	v->pitchRatioFixed = (fixed32p32)(tsf_timecents2Secsd(v->pitchInputTimecents) * v->pitchOutputFactor * 4294967296.0);
 }
 
-short tsf_read_short_cached(tsf *f, int pos)
+static TSF_BOOL tsf_sample_cache_init(struct tsf_sample_cache* c, int blocks, int blockSize, TSF_BOOL with24)
 {
-	static int hits = 0;
-	static int misses = 0;
-//	static int call =0;
-//	call++;
-//	if ((call % 88000) ==0) printf("Hit: %d, Miss: %d, Ratio: %f\n", hits, misses, (double)hits/(double)(misses+hits));
-
-	for (int i=0; i<TSF_BUFFS; i++) {
-		if ((f->offset[i] <= pos) && ((f->offset[i] + TSF_BUFFSIZE) > pos) ) {
-			f->timestamp[i] = f->epoch++;
-			if (f->epoch==0) {
-				for (int i=0; i<TSF_BUFFS; i++) f->timestamp[i] = f->epoch++;
-			}
-			hits++;
-      return f->buffer[i][pos - f->offset[i]];
-		}
+	int i, hashSize;
+	for (hashSize = 1; hashSize < blocks * 2; hashSize <<= 1) {}
+	TSF_MEMSET(c, 0, sizeof(*c));
+	c->data = (short*)TSF_MALLOC((blocks + 1) * blockSize * sizeof(short));
+	c->data24 = (with24 ? (unsigned char*)TSF_MALLOC((blocks + 1) * blockSize) : TSF_NULL);
+	c->offset = (int*)TSF_MALLOC((blocks * 3 + hashSize) * sizeof(int));
+	c->referenced = (TSF_BOOL*)TSF_MALLOC(blocks * sizeof(TSF_BOOL));
+	c->requests = (struct tsf_stream_request*)TSF_MALLOC((blocks + 1) * sizeof(struct tsf_stream_request));
+	if (!c->data || (with24 && !c->data24) || !c->offset || !c->referenced || !c->requests)
+	{
+		TSF_FREE(c->data);
+		TSF_FREE(c->data24);
+		TSF_FREE(c->offset);
+		TSF_FREE(c->referenced);
+		TSF_FREE(c->requests);
+		return TSF_FALSE;
+	}
+	c->silence = c->data + blocks * blockSize;
+	TSF_MEMSET(c->silence, 0, blockSize * sizeof(short));
+	if (with24)
+	{
+		c->silence24 = c->data24 + blocks * blockSize;
+		TSF_MEMSET(c->silence24, 0, blockSize);
 	}
-	int repl = 0;
-	for (int i=1; i<TSF_BUFFS; i++) {
-		if (f->timestamp[i] < f->timestamp[repl]) repl = i;
+	c->next = c->offset + blocks;
+	c->ready = c->next + blocks;
+	c->hashHead = c->ready + blocks;
+	c->blocks = blocks;
+	c->blockSize = blockSize;
+	c->hashMask = hashSize - 1;
+	c->requestNum = blocks + 1;
+	for (i = 0; i < blocks; i++)
+	{
+		c->offset[i] = -1;
+		c->next[i] = -1;
+		c->ready[i] = TSF_TRUE;
+		c->referenced[i] = TSF_FALSE;
 	}
-	int readOff = pos - (pos % TSF_BUFFSIZE);
-// for (int i=0; i<TSF_BUFFSIZE; i++) { f->buffer[repl][i] = i; }
-	f->hydra->stream->seek(f->hydra->stream->data, readOff * sizeof(short));
-	f->hydra->stream->read(f->hydra->stream->data, f->buffer[repl], TSF_BUFFSIZE * sizeof(short));
-//static uint32_t *bp = NULL; if (!bp) bp = (uint32_t*)malloc(512);
-//printf("off=%08x, buff=%p, len=%08x\n", readOff * sizeof(short), bp, TSF_BUFFSIZE); spi_flash_read(0x0000, bp, 512/4-4) ;
-	f->timestamp[repl] = f->epoch++;
-	f->offset[repl] = readOff;
-	misses++;
-	return f->buffer[repl][pos - readOff];
+	for (i = 0; i < hashSize; i++) c->hashHead[i] = -1;
+	return TSF_TRUE;
 }
 
-static void tsf_voice_render(tsf* f, struct tsf_voice* v, float* outputBuffer, int numSamples)
+static void tsf_sample_cache_free(struct tsf_sample_cache* c)
 {
-	struct tsf_region* region = v->region;
-	float* outL = outputBuffer;
-	float* outR = (f->outputmode == TSF_STEREO_UNWEAVED ? outL + numSamples : TSF_NULL);
-
-	// Cache some values, to give them at least some chance of ending up in registers.
-	TSF_BOOL updateModEnv = (region->modEnvToPitch || region->modEnvToFilterFc);
-	TSF_BOOL updateModLFO = (v->modlfo.delta && (region->modLfoToPitch || region->modLfoToFilterFc || region->modLfoToVolume));
-	TSF_BOOL updateVibLFO = (v->viblfo.delta && (region->vibLfoToPitch));
-	TSF_BOOL isLooping    = (v->loopStart < v->loopEnd);
-	unsigned int tmpLoopStart = v->loopStart, tmpLoopEnd = v->loopEnd;
-	double tmpSampleEndDbl = (double)v->sampleEnd, tmpLoopEndDbl = (double)tmpLoopEnd + 1.0;
-	double tmpSourceSamplePosition = v->sourceSamplePosition;
-	struct tsf_voice_lowpass tmpLowpass = v->lowpass;
+	TSF_FREE(c->data);
+	TSF_FREE(c->data24);
+	TSF_FREE(c->offset);
+	TSF_FREE(c->referenced);
+	TSF_FREE(c->requests);
+}
 
-	TSF_BOOL dynamicLowpass = (region->modLfoToFilterFc || region->modEnvToFilterFc);
-	float tmpSampleRate, tmpInitialFilterFc, tmpModLfoToFilterFc, tmpModEnvToFilterFc;
+static int tsf_decode_compressed(tsf *f, struct tsf_compressed_sample* c, unsigned int pos, short* out, unsigned int count)
+{
+	if (!c->handle)
+	{
+		const char* data = (f->hydra->memory ? f->hydra->memory + f->fontSamplesOffset + c->start : TSF_NULL);
+		if (!f->decoder.open || !c->size) return 0;
+		if (!data)
+		{
+			if (!(c->data = (char*)TSF_MALLOC(c->size))) return 0;
+			f->hydra->stream->seek(f->hydra->stream->data, f->fontSamplesOffset + c->start);
+			if (f->hydra->stream->read(f->hydra->stream->data, c->data, c->size)) data = c->data;
+		}
+		if (data) c->handle = f->decoder.open(f->decoder.data, data, c->size);
+		if (!c->handle)
+		{
+			// Don't try again
+			TSF_FREE(c->data);
+			c->data = TSF_NULL;
+			c->size = 0;
+			return 0;
+		}
+	}
+	return f->decoder.decode(f->decoder.data, c->handle, pos, out, count);
+}
 
-	TSF_BOOL dynamicPitchRatio = (region->modLfoToPitch || region->modEnvToPitch || region->vibLfoToPitch);
-	double pitchRatio;
-	float tmpModLfoToPitch, tmpVibLfoToPitch, tmpModEnvToPitch;
+// Read 'count' samples starting at 'pos' into 'out', compressed samples are decoded.
+// Returns false if the raw sample data could not be read from the stream.
+static TSF_BOOL tsf_read_sample_data(tsf *f, short* out, unsigned int pos, unsigned int count)
+{
+	unsigned int rawEnd = (f->compressedNum ? f->compressed[0].pos : (unsigned int)-1), n;
+	int i = 0;
+	if (pos < rawEnd)
+	{
+		// Sample positions are relative to the start of the smpl chunk
+		n = (count < rawEnd - pos ? count : rawEnd - pos);
+		f->hydra->stream->seek(f->hydra->stream->data, f->fontSamplesOffset + pos * sizeof(short));
+		if (!f->hydra->stream->read(f->hydra->stream->data, out, n * sizeof(short))) return TSF_FALSE;
+		out += n; pos += n; count -= n;
+	}
+	for (; count; out += n, pos += n, count -= n)
+	{
+		// Find the last compressed sample starting at or before 'pos'
+		struct tsf_compressed_sample* c;
+		unsigned int decoded, next;
+		while (i + 1 < f->compressedNum && f->compressed[i + 1].pos <= pos) i++;
+		c = &f->compressed[i];
+		next = (i + 1 < f->compressedNum ? f->compressed[i + 1].pos : (unsigned int)-1);
+		n = (count < next - pos ? count : next - pos);
+		decoded = 0;
+		if (pos - c->pos < c->length)
+		{
+			if (n > c->length - (pos - c->pos)) n = c->length - (pos - c->pos);
+			decoded = tsf_decode_compressed(f, c, pos - c->pos, out, n);
+		}
+		if (decoded < n) TSF_MEMSET(out + decoded, 0, (n - decoded) * sizeof(short));
+	}
+	return TSF_TRUE;
+}
 
-	TSF_BOOL dynamicGain = (region->modLfoToVolume != 0);
-	float noteGain, tmpModLfoToVolume;
+// Read the low bytes of 'count' 24-bit samples starting at 'pos' into 'out'
+static TSF_BOOL tsf_read_sample_data24(tsf *f, unsigned char* out, unsigned int pos, unsigned int count)
+{
+	f->hydra->stream->seek(f->hydra->stream->data, f->fontSamples24Offset + pos);
+	return (f->hydra->stream->read(f->hydra->stream->data, out, count) ? TSF_TRUE : TSF_FALSE);
+}
 
-	if (dynamicLowpass) tmpSampleRate = f->outSampleRate, tmpInitialFilterFc = (float)region->initialFilterFc, tmpModLfoToFilterFc = (float)region->modLfoToFilterFc, tmpModEnvToFilterFc = (float)region->modEnvToFilterFc;
-	else tmpSampleRate = 0, tmpInitialFilterFc = 0, tmpModLfoToFilterFc = 0, tmpModEnvToFilterFc = 0;
+static void tsf_cache_load(tsf *f, int block, int offset)
+{
+	tsf_read_sample_data(f, &f->cache.data[block * f->cache.blockSize], offset, f->cache.blockSize);
+	if (f->cache.data24) tsf_read_sample_data24(f, &f->cache.data24[block * f->cache.blockSize], offset, f->cache.blockSize);
+}
 
-	if (dynamicPitchRatio) pitchRatio = 0, tmpModLfoToPitch = (float)region->modLfoToPitch, tmpVibLfoToPitch = (float)region->vibLfoToPitch, tmpModEnvToPitch = (float)region->modEnvToPitch;
-	else pitchRatio = tsf_timecents2Secsd(v->pitchInputTimecents) * v->pitchOutputFactor, tmpModLfoToPitch = 0, tmpVibLfoToPitch = 0, tmpModEnvToPitch = 0;
+// Returns the cache block holding the sample at 'pos' or -1 if it isn't loaded (yet) in streaming mode
+static int tsf_cache_block(tsf *f, unsigned int pos)
+{
+	struct tsf_sample_cache* c = &f->cache;
+	int readOff = pos - (pos % c->blockSize), *link, i, n;
+	int* head = &c->hashHead[(pos / c->blockSize) & c->hashMask];
+
+	for (i = *head; i >= 0; i = c->next[i]) {
+		if (c->offset[i] == readOff) {
+			c->referenced[i] = TSF_TRUE;
+			if (c->streaming && !TSF_ATOMIC_LOAD(&c->ready[i])) return -1;
+			c->stats.hits++;
+			return i;
+		}
+	}
 
-	if (dynamicGain) noteGain = 0, tmpModLfoToVolume = (float)region->modLfoToVolume * 0.1f;
-	else noteGain = tsf_decibelsToGain(v->noteGainDB), tmpModLfoToVolume = 0;
+	// Advance the clock hand to the first block not referenced since the last pass,
+	// blocks still being loaded by the I/O thread can't be replaced.
+	for (n = c->blocks * 2; c->referenced[c->clockHand] || !TSF_ATOMIC_LOAD(&c->ready[c->clockHand]); c->clockHand = (c->clockHand + 1) % c->blocks) {
+		if (!n--) return -1;
+		c->referenced[c->clockHand] = TSF_FALSE;
+	}
+	i = c->clockHand;
+	c->clockHand = (c->clockHand + 1) % c->blocks;
+
+	// Unlink the replaced block from its hash chain
+	if (c->offset[i] >= 0) {
+		for (link = &c->hashHead[(c->offset[i] / c->blockSize) & c->hashMask]; *link != i; link = &c->next[*link]) {}
+		*link = c->next[i];
+		c->stats.evictions++;
+	}
 
-	while (numSamples)
+	c->offset[i] = readOff;
+	c->referenced[i] = TSF_TRUE;
+	c->next[i] = *head;
+	*head = i;
+	c->stats.misses++;
+	c->stats.bytesRead += c->blockSize * (c->data24 ? 3 : sizeof(short));
+	if (c->streaming)
 	{
-		float gainMono, gainLeft, gainRight;
-		int blockSamples = (numSamples > TSF_RENDER_EFFECTSAMPLEBLOCK ? TSF_RENDER_EFFECTSAMPLEBLOCK : numSamples);
-		numSamples -= blockSamples;
-
-		if (dynamicLowpass)
-		{
-			float fres = tmpInitialFilterFc + v->modlfo.level * tmpModLfoToFilterFc + v->modenv.level * tmpModEnvToFilterFc;
-			tmpLowpass.active = (fres <= 13500.0f);
-			if (tmpLowpass.active) tsf_voice_lowpass_setup(&tmpLowpass, tsf_cents2Hertz(fres) / tmpSampleRate);
-		}
+		// The queue can't overflow as it has room for every block
+		struct tsf_stream_request* r = &c->requests[c->requestTail];
+		r->block = i;
+		r->offset = readOff;
+		c->ready[i] = TSF_FALSE;
+		TSF_ATOMIC_STORE(&c->requestTail, (c->requestTail + 1) % c->requestNum);
+		return -1;
+	}
+	tsf_cache_load(f, i, readOff);
+	return i;
+}
 
-		if (dynamicPitchRatio)
-			pitchRatio = tsf_timecents2Secsd(v->pitchInputTimecents + (v->modlfo.level * tmpModLfoToPitch + v->viblfo.level * tmpVibLfoToPitch + v->modenv.level * tmpModEnvToPitch)) * v->pitchOutputFactor;
+short tsf_read_short_cached(tsf *f, int pos)
+{
+	int i;
+	if (f->fontSamples) return (pos >= 0 && pos < f->fontSampleCount ? f->fontSamples[pos] : 0);
+	i = tsf_cache_block(f, pos);
+	if (i < 0) { f->cache.stats.underruns++; return 0; }
+	return f->cache.data[i * f->cache.blockSize + pos - f->cache.offset[i]];
+}
 
-		if (dynamicGain)
-			noteGain = tsf_decibelsToGain(v->noteGainDB + (v->modlfo.level * tmpModLfoToVolume));
+// Returns a pointer to the sample at 'pos' and stores in 'count' how many samples
+// starting at 'pos' can be read contiguously from it (always at least 1).
+// For 24-bit samples 'low' is set to their low bytes, otherwise to NULL.
+static const short* tsf_read_samples_cached(tsf *f, unsigned int pos, unsigned int* count, const unsigned char** low)
+{
+	static const short outOfRange = 0;
+	static const unsigned char outOfRange24 = 0;
+	int i;
+	if (f->fontSamples)
+	{
+		if (pos >= (unsigned int)f->fontSamplesAvail) { *count = 1; *low = (f->fontSamples24 ? &outOfRange24 : TSF_NULL); return &outOfRange; }
+		*count = f->fontSamplesAvail - pos;
+		*low = (f->fontSamples24 ? f->fontSamples24 + pos : TSF_NULL);
+		return f->fontSamples + pos;
+	}
+	i = tsf_cache_block(f, pos);
+	*count = f->cache.blockSize - (pos % f->cache.blockSize);
+	if (i < 0) { f->cache.stats.underruns++; *low = f->cache.silence24; return f->cache.silence; }
+	*low = (f->cache.data24 ? &f->cache.data24[i * f->cache.blockSize + pos - f->cache.offset[i]] : TSF_NULL);
+	return &f->cache.data[i * f->cache.blockSize + pos - f->cache.offset[i]];
+}
+
+// Make sure the cache blocks covering the samples from 'from' up to (excluding) 'to' are loaded
+static void tsf_cache_touch(tsf *f, unsigned int from, unsigned int to)
+{
+	for (from -= from % f->cache.blockSize; from < to; from += f->cache.blockSize)
+		tsf_cache_block(f, from);
+}
+
+// Read ahead the samples a voice will play next, starting at 'pos' and spanning 'count' samples.
+// For looping voices the samples after the loop start are kept in the cache as well,
+// so stream reads happen at most once per render block and never in the middle of it.
+static void tsf_voice_prefetch(tsf *f, struct tsf_voice* v, unsigned int pos, unsigned int count)
+{
+	unsigned int end = pos + count + TSF_PREFETCH_SAMPLES + 1;
+	if (f->fontSamples) return;
+	if (v->loopStart < v->loopEnd && pos <= v->loopEnd)
+	{
+		// Marking the loop start blocks as used each time keeps the loop region resident
+		unsigned int wrapped = (end > v->loopEnd + 1 ? end - v->loopEnd - 1 : 1);
+		if (wrapped > v->loopEnd + 1 - v->loopStart) wrapped = v->loopEnd + 1 - v->loopStart;
+		tsf_cache_touch(f, pos, (end > v->loopEnd + 2 ? v->loopEnd + 2 : end));
+		tsf_cache_touch(f, v->loopStart, v->loopStart + wrapped);
+	}
+	else tsf_cache_touch(f, pos, (end > v->sampleEnd + 1 ? v->sampleEnd + 1 : end));
+}
+
+// A window of contiguous samples held by a voice renderer so the cache lookup
+// only happens when the playback position leaves the current cache block.
+// Any other cache access can replace the block so every read goes through the span.
+// With 24-bit samples 'low' holds their low bytes, otherwise it is NULL.
+struct tsf_sample_span { const short* data; const unsigned char* low; unsigned int start, len; };
+
+static short tsf_sample_span_read(tsf *f, struct tsf_sample_span* s, unsigned int pos)
+{
+	if (pos - s->start >= s->len) { s->data = tsf_read_samples_cached(f, pos, &s->len, &s->low); s->start = pos; }
+	return s->data[pos - s->start];
+}
+
+// Read the sample at 'pos' normalized to -1 .. 1
+static float tsf_sample_span_float(tsf *f, struct tsf_sample_span* s, unsigned int pos)
+{
+	short hi = tsf_sample_span_read(f, s, pos);
+	if (!s->low) return hi * (1.0f / 32767.0f);
+	return (hi * 256 + s->low[pos - s->start]) * (1.0f / (32767.0f * 256.0f)); // the same scale as 16-bit samples
+}
+
+// The mix functions ramp the gain linearly, sample 'i' is multiplied by 'gain + step * i'
+// (computed from the sample index rather than accumulated so the SIMD and scalar code give the same result)
+#if defined(TSF_SSE2)
+#  define TSF_RAMP(gain, step) _mm_add_ps(_mm_set1_ps(gain), _mm_mul_ps(_mm_set1_ps(step), idx))
+#elif defined(TSF_NEON)
+#  define TSF_RAMP(gain, step) vaddq_f32(vdupq_n_f32(gain), vmulq_f32(vdupq_n_f32(step), idx))
+#endif
+
+// Add 'n' mono samples with the ramped 'gain' to 'out'
+static void tsf_mix_mono(float* out, const float* in, int n, float gain, float step)
+{
+	int i = 0;
+	#if defined(TSF_SSE2)
+	__m128 idx = _mm_set_ps(3, 2, 1, 0);
+	for (; i + 4 <= n; i += 4, idx = _mm_add_ps(idx, _mm_set1_ps(4)))
+		_mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), TSF_RAMP(gain, step))));
+	#elif defined(TSF_NEON)
+	static const float idxInit[4] = { 0, 1, 2, 3 };
+	float32x4_t idx = vld1q_f32(idxInit);
+	for (; i + 4 <= n; i += 4, idx = vaddq_f32(idx, vdupq_n_f32(4)))
+		vst1q_f32(out + i, vaddq_f32(vld1q_f32(out + i), vmulq_f32(vld1q_f32(in + i), TSF_RAMP(gain, step))));
+	#endif
+	for (; i < n; i++) out[i] += in[i] * (gain + step * i);
+}
+
+// Add 'n' mono samples to the separate left and right channels 'outL' and 'outR'
+static void tsf_mix_unweaved(float* outL, float* outR, const float* in, int n, float gainL, float stepL, float gainR, float stepR)
+{
+	int i = 0;
+	#if defined(TSF_SSE2)
+	__m128 idx = _mm_set_ps(3, 2, 1, 0);
+	for (; i + 4 <= n; i += 4, idx = _mm_add_ps(idx, _mm_set1_ps(4)))
+	{
+		__m128 v = _mm_loadu_ps(in + i);
+		_mm_storeu_ps(outL + i, _mm_add_ps(_mm_loadu_ps(outL + i), _mm_mul_ps(v, TSF_RAMP(gainL, stepL))));
+		_mm_storeu_ps(outR + i, _mm_add_ps(_mm_loadu_ps(outR + i), _mm_mul_ps(v, TSF_RAMP(gainR, stepR))));
+	}
+	#elif defined(TSF_NEON)
+	static const float idxInit[4] = { 0, 1, 2, 3 };
+	float32x4_t idx = vld1q_f32(idxInit);
+	for (; i + 4 <= n; i += 4, idx = vaddq_f32(idx, vdupq_n_f32(4)))
+	{
+		float32x4_t v = vld1q_f32(in + i);
+		vst1q_f32(outL + i, vaddq_f32(vld1q_f32(outL + i), vmulq_f32(v, TSF_RAMP(gainL, stepL))));
+		vst1q_f32(outR + i, vaddq_f32(vld1q_f32(outR + i), vmulq_f32(v, TSF_RAMP(gainR, stepR))));
+	}
+	#endif
+	for (; i < n; i++) { outL[i] += in[i] * (gainL + stepL * i); outR[i] += in[i] * (gainR + stepR * i); }
+}
+
+// Add 'n' mono samples to the interleaved stereo output 'out'
+static void tsf_mix_interleaved(float* out, const float* in, int n, float gainL, float stepL, float gainR, float stepR)
+{
+	int i = 0;
+	#if defined(TSF_SSE2)
+	__m128 idx = _mm_set_ps(3, 2, 1, 0);
+	for (; i + 4 <= n; i += 4, idx = _mm_add_ps(idx, _mm_set1_ps(4)))
+	{
+		__m128 v = _mm_loadu_ps(in + i), l = _mm_mul_ps(v, TSF_RAMP(gainL, stepL)), r = _mm_mul_ps(v, TSF_RAMP(gainR, stepR));
+		_mm_storeu_ps(out + i * 2, _mm_add_ps(_mm_loadu_ps(out + i * 2), _mm_unpacklo_ps(l, r)));
+		_mm_storeu_ps(out + i * 2 + 4, _mm_add_ps(_mm_loadu_ps(out + i * 2 + 4), _mm_unpackhi_ps(l, r)));
+	}
+	#elif defined(TSF_NEON)
+	static const float idxInit[4] = { 0, 1, 2, 3 };
+	float32x4_t idx = vld1q_f32(idxInit);
+	for (; i + 4 <= n; i += 4, idx = vaddq_f32(idx, vdupq_n_f32(4)))
+	{
+		float32x4_t v = vld1q_f32(in + i);
+		float32x4x2_t o = vld2q_f32(out + i * 2);
+		o.val[0] = vaddq_f32(o.val[0], vmulq_f32(v, TSF_RAMP(gainL, stepL)));
+		o.val[1] = vaddq_f32(o.val[1], vmulq_f32(v, TSF_RAMP(gainR, stepR)));
+		vst2q_f32(out + i * 2, o);
+	}
+	#endif
+	for (; i < n; i++) { out[i * 2] += in[i] * (gainL + stepL * i); out[i * 2 + 1] += in[i] * (gainR + stepR * i); }
+}
+#undef TSF_RAMP
+
+#if defined(TSF_SSE2) || defined(TSF_NEON)
+// Linear interpolation of 16-bit samples for 'block[n]' up to before 'block[end]' with the same results
+// as TSF_INTERPOLATE_LINEAR, 'data' points at the sample at 'dataPos' and all taps are in it.
+// The positions are still added up one by one so the results don't depend on where a run starts.
+// Returns the first sample that was not interpolated, the rest is left to the scalar code.
+// Only compilers that contract multiply-adds on their own (GCC with FMA) can make the last bit differ.
+static int tsf_interpolate_linear_run(float* block, int n, int end, double* position, double pitchRatio, const short* data, unsigned int dataPos)
+{
+	double p = *position;
+	// The vector conversions truncate the positions as signed 32-bit values
+	if (p + (end - n) * pitchRatio >= 2147483647.0) return n;
+	#if defined(TSF_AVX2)
+	{
+		const __m256 scale = _mm256_set1_ps(1.0f / 32767.0f);
+		const __m256i first = _mm256_set1_epi32((int)dataPos);
+		for (; n + 8 <= end; n += 8)
+		{
+			double p1 = p + pitchRatio, p2 = p1 + pitchRatio, p3 = p2 + pitchRatio, p4 = p3 + pitchRatio, p5 = p4 + pitchRatio, p6 = p5 + pitchRatio, p7 = p6 + pitchRatio;
+			__m256d pa = _mm256_set_pd(p3, p2, p1, p), pb = _mm256_set_pd(p7, p6, p5, p4);
+			__m128i ta = _mm256_cvttpd_epi32(pa), tb = _mm256_cvttpd_epi32(pb);
+			__m256 alpha = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_sub_pd(pb, _mm256_cvtepi32_pd(tb))), _mm256_cvtpd_ps(_mm256_sub_pd(pa, _mm256_cvtepi32_pd(ta))));
+			// Each 32-bit gather loads a sample in the low and the next one in the high half
+			__m256i pair = _mm256_i32gather_epi32((const int*)data, _mm256_sub_epi32(_mm256_set_m128i(tb, ta), first), 2);
+			__m256 y0 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(pair, 16), 16)), scale);
+			__m256 y1 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(pair, 16)), scale);
+			_mm256_storeu_ps(block + n, _mm256_add_ps(y0, _mm256_mul_ps(_mm256_sub_ps(y1, y0), alpha)));
+			p = p7 + pitchRatio;
+		}
+	}
+	#elif defined(TSF_SSE2)
+	{
+		const __m128 scale = _mm_set1_ps(1.0f / 32767.0f);
+		const __m128i first = _mm_set1_epi32((int)dataPos);
+		int idx[4];
+		for (; n + 4 <= end; n += 4)
+		{
+			double p1 = p + pitchRatio, p2 = p1 + pitchRatio, p3 = p2 + pitchRatio;
+			__m128d pa = _mm_set_pd(p1, p), pb = _mm_set_pd(p3, p2);
+			__m128i ta = _mm_cvttpd_epi32(pa), tb = _mm_cvttpd_epi32(pb);
+			__m128 alpha = _mm_movelh_ps(_mm_cvtpd_ps(_mm_sub_pd(pa, _mm_cvtepi32_pd(ta))), _mm_cvtpd_ps(_mm_sub_pd(pb, _mm_cvtepi32_pd(tb))));
+			__m128 y0, y1;
+			_mm_storeu_si128((__m128i*)idx, _mm_sub_epi32(_mm_unpacklo_epi64(ta, tb), first));
+			y0 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_set_epi32(data[idx[3]], data[idx[2]], data[idx[1]], data[idx[0]])), scale);
+			y1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_set_epi32(data[idx[3] + 1], data[idx[2] + 1], data[idx[1] + 1], data[idx[0] + 1])), scale);
+			_mm_storeu_ps(block + n, _mm_add_ps(y0, _mm_mul_ps(_mm_sub_ps(y1, y0), alpha)));
+			p = p3 + pitchRatio;
+		}
+	}
+	#elif defined(TSF_NEON)
+	{
+		// Without double vectors on 32-bit ARM the positions are split up one by one
+		const float32x4_t scale = vdupq_n_f32(1.0f / 32767.0f);
+		float alphas[4];
+		int32_t s0[4], s1[4];
+		int i;
+		for (; n + 4 <= end; n += 4)
+		{
+			float32x4_t alpha, y0, y1;
+			for (i = 0; i != 4; i++, p += pitchRatio)
+			{
+				unsigned int pos = (unsigned int)p;
+				alphas[i] = (float)(p - pos);
+				s0[i] = data[pos - dataPos];
+				s1[i] = data[pos - dataPos + 1];
+			}
+			alpha = vld1q_f32(alphas);
+			y0 = vmulq_f32(vcvtq_f32_s32(vld1q_s32(s0)), scale);
+			y1 = vmulq_f32(vcvtq_f32_s32(vld1q_s32(s1)), scale);
+			vst1q_f32(block + n, vaddq_f32(y0, vmulq_f32(vsubq_f32(y1, y0), alpha)));
+		}
+	}
+	#endif
+	*position = p;
+	return n;
+}
+#endif
+
+static void tsf_voice_render(tsf* f, struct tsf_voice* v, float* outputBuffer, int numSamples)
+{
+	struct tsf_region* region = v->region;
+	float* outL = outputBuffer;
+	float* outR = (f->outputmode == TSF_STEREO_UNWEAVED ? outL + numSamples : TSF_NULL);
+
+	// Cache some values, to give them at least some chance of ending up in registers.
+	TSF_BOOL updateModEnv = (region->modEnvToPitch || region->modEnvToFilterFc);
+	TSF_BOOL updateModLFO = (v->modlfo.delta && (region->modLfoToPitch || region->modLfoToFilterFc || region->modLfoToVolume));
+	TSF_BOOL updateVibLFO = (v->viblfo.delta && (region->vibLfoToPitch));
+	TSF_BOOL isLooping    = (v->loopStart < v->loopEnd);
+	unsigned int tmpLoopStart = v->loopStart, tmpLoopEnd = v->loopEnd;
+	double tmpSampleEndDbl = (double)v->sampleEnd, tmpLoopEndDbl = (double)tmpLoopEnd + 1.0;
+	double tmpSourceSamplePosition = v->sourceSamplePosition;
+	struct tsf_voice_lowpass tmpLowpass = v->lowpass;
+	struct tsf_sample_span span = { TSF_NULL, TSF_NULL, 0, 0 };
+
+	// Number of samples the interpolation reads before and after the current one
+	unsigned int tapsBefore = (f->interpolation == TSF_INTERPOLATION_HERMITE ? 1 : f->interpolation >= TSF_INTERPOLATION_SINC8 ? f->sincTaps / 2 - 1 : 0);
+	unsigned int tapsAfter = (f->interpolation == TSF_INTERPOLATION_HERMITE ? 2 : f->interpolation >= TSF_INTERPOLATION_SINC8 ? f->sincTaps / 2 : 1);
+
+	TSF_BOOL dynamicLowpass = (region->modLfoToFilterFc || region->modEnvToFilterFc);
+	float tmpSampleRate, tmpInitialFilterFc, tmpModLfoToFilterFc, tmpModEnvToFilterFc;
+
+	TSF_BOOL dynamicPitchRatio = (region->modLfoToPitch || region->modEnvToPitch || region->vibLfoToPitch);
+	double pitchRatio;
+	float tmpModLfoToPitch, tmpVibLfoToPitch, tmpModEnvToPitch;
+
+	TSF_BOOL dynamicGain = (region->modLfoToVolume != 0);
+	float noteGain, tmpModLfoToVolume;
+
+	if (dynamicLowpass) tmpSampleRate = f->outSampleRate, tmpInitialFilterFc = (float)region->initialFilterFc, tmpModLfoToFilterFc = (float)region->modLfoToFilterFc, tmpModEnvToFilterFc = (float)region->modEnvToFilterFc;
+	else tmpSampleRate = 0, tmpInitialFilterFc = 0, tmpModLfoToFilterFc = 0, tmpModEnvToFilterFc = 0;
+
+	if (dynamicPitchRatio) pitchRatio = 0, tmpModLfoToPitch = (float)region->modLfoToPitch, tmpVibLfoToPitch = (float)region->vibLfoToPitch, tmpModEnvToPitch = (float)region->modEnvToPitch;
+	else pitchRatio = tsf_timecents2Secsd(v->pitchInputTimecents) * v->pitchOutputFactor, tmpModLfoToPitch = 0, tmpVibLfoToPitch = 0, tmpModEnvToPitch = 0;
+
+	if (dynamicGain) tmpModLfoToVolume = (float)region->modLfoToVolume * 0.1f, noteGain = tsf_decibelsToGain(v->noteGainDB + (v->modlfo.level * tmpModLfoToVolume));
+	else noteGain = tsf_decibelsToGain(v->noteGainDB), tmpModLfoToVolume = 0;
+
+	while (numSamples)
+	{
+		float gainMono, gainStep, block[TSF_RENDER_EFFECTSAMPLEBLOCK];
+		int n, blockSamples = (numSamples > TSF_RENDER_EFFECTSAMPLEBLOCK ? TSF_RENDER_EFFECTSAMPLEBLOCK : numSamples);
+		numSamples -= blockSamples;
+
+		if (dynamicLowpass)
+		{
+			float fres = tmpInitialFilterFc + v->modlfo.level * tmpModLfoToFilterFc + v->modenv.level * tmpModEnvToFilterFc;
+			tmpLowpass.active = (fres <= 13500.0f);
+			if (tmpLowpass.active) tsf_voice_lowpass_setup(&tmpLowpass, tsf_cents2Hertz(fres) / tmpSampleRate);
+		}
+
+		if (dynamicPitchRatio)
+			pitchRatio = tsf_timecents2Secsd(v->pitchInputTimecents + (v->modlfo.level * tmpModLfoToPitch + v->viblfo.level * tmpVibLfoToPitch + v->modenv.level * tmpModEnvToPitch)) * v->pitchOutputFactor;
 
 		gainMono = noteGain * v->ampenv.level;
 
+		// Load the samples of this block now, this also invalidates the span.
+		{
+			unsigned int pos = (unsigned int)tmpSourceSamplePosition, before = (pos < tapsBefore ? pos : tapsBefore);
+			tsf_voice_prefetch(f, v, pos - before, (unsigned int)(blockSamples * pitchRatio) + before + tapsAfter);
+		}
+		span.len = 0;
+
 		// Update EG.
 		tsf_voice_envelope_process(&v->ampenv, blockSamples, f->outSampleRate);
 		if (updateModEnv) tsf_voice_envelope_process(&v->modenv, blockSamples, f->outSampleRate);
@@ -1172,81 +2231,143 @@ static void tsf_voice_render(tsf* f, struct tsf_voice* v, float* outputBuffer, i
 		if (updateModLFO) tsf_voice_lfo_process(&v->modlfo, blockSamples);
 		if (updateVibLFO) tsf_voice_lfo_process(&v->viblfo, blockSamples);
 
+		// Ramp the gain to where the envelope and LFO are at the end of the block
+		if (dynamicGain)
+			noteGain = tsf_decibelsToGain(v->noteGainDB + (v->modlfo.level * tmpModLfoToVolume));
+		gainStep = (noteGain * v->ampenv.level - gainMono) / blockSamples;
+
+		// Interpolate and filter the samples of this block into a mono buffer.
+		// There is a kernel for each interpolation and combination of looping and filtering. Each
+		// kernel processes runs of samples that can neither hit the loop or sample end nor read a
+		// tap across the loop point or outside of the span, these read the span memory directly.
+		// Each run is followed by one fully checked sample.
+		// READ##_AT reads the sample at 'pos', READ##_BEFORE(k) and READ##_AFTER(k) the sample 'k' samples before or after it.
+		#define TSF_INTERPOLATE_NEAREST(READ) \
+			val = (alpha < 0.5f ? READ##_AT : READ##_AFTER(1));
+		// The product is a separate statement so compilers that only contract a multiply and an add in the same
+		// expression into a fused multiply-add do so neither here nor in tsf_interpolate_linear_run
+		#define TSF_INTERPOLATE_LINEAR(READ) \
+			float inputPos = READ##_AT, inputNextPos = READ##_AFTER(1), delta = (inputNextPos - inputPos) * alpha; \
+			val = inputPos + delta;
+		#define TSF_INTERPOLATE_HERMITE(READ) \
+			float ym1 = READ##_BEFORE(1), y0 = READ##_AT; \
+			float y1 = READ##_AFTER(1), y2 = READ##_AFTER(2); \
+			float c1 = 0.5f * (y1 - ym1), c2 = ym1 - 2.5f * y0 + 2.0f * y1 - 0.5f * y2, c3 = 0.5f * (y2 - ym1) + 1.5f * (y0 - y1); \
+			val = ((c3 * alpha + c2) * alpha + c1) * alpha + y0;
+		#define TSF_INTERPOLATE_SINC(READ) \
+			const float* coeffs = f->sincTable + (int)(alpha * TSF_SINC_PHASES + 0.5f) * f->sincTaps; \
+			int k, taps = f->sincTaps, first = 1 - taps / 2; \
+			for (val = 0, k = 0; k != -first; k++) val += READ##_BEFORE(-first - k) * coeffs[k]; \
+			for (; k != taps; k++) val += READ##_AFTER(first + k) * coeffs[k];
+		// Unfiltered unchecked runs of 16-bit samples are linearly interpolated with vectors. With the
+		// filter the scalar interpolation is hidden behind the latency of the filter and a separate pass is slower.
+		#define TSF_INTERPOLATE_NEAREST_RUN(FILTERED)
+		#define TSF_INTERPOLATE_HERMITE_RUN(FILTERED)
+		#define TSF_INTERPOLATE_SINC_RUN(FILTERED)
+		#if defined(TSF_SSE2) || defined(TSF_NEON)
+		#define TSF_INTERPOLATE_LINEAR_RUN(FILTERED) \
+			if (!FILTERED && !runLow) n = tsf_interpolate_linear_run(block, n, run, &tmpSourceSamplePosition, pitchRatio, runData, runPos);
+		#else
+		#define TSF_INTERPOLATE_LINEAR_RUN(FILTERED)
+		#endif
+		// Position of the sample 'k' samples before or after 'pos', following the loop
+		#define TSF_TAP_BEFORE(k) (pos >= (unsigned int)(k) ? pos - (k) : 0)
+		#define TSF_TAP_AFTER(k) (pos + (k) > tmpLoopEnd && isLooping ? pos + (k) - (tmpLoopEnd - tmpLoopStart + 1) : pos + (k))
+		#define TSF_READ_AT tsf_sample_span_float(f, &span, pos)
+		#define TSF_READ_BEFORE(k) tsf_sample_span_float(f, &span, TSF_TAP_BEFORE(k))
+		#define TSF_READ_AFTER(k) tsf_sample_span_float(f, &span, TSF_TAP_AFTER(k))
+		// The same value as tsf_sample_span_float from the span memory, 'runData' and 'runLow' point at the sample at 'pos' of the first sample of the run
+		#define TSF_READ_RUN(i) (runLow ? (runData[i] * 256 + runLow[i]) * (1.0f / (32767.0f * 256.0f)) : runData[i] * (1.0f / 32767.0f))
+		#define TSF_READ_UNCHECKED_AT TSF_READ_RUN((int)(pos - runPos))
+		#define TSF_READ_UNCHECKED_BEFORE(k) TSF_READ_RUN((int)(pos - runPos) - (k))
+		#define TSF_READ_UNCHECKED_AFTER(k) TSF_READ_RUN((int)(pos - runPos) + (k))
+		#define TSF_SAMPLE(INTERP, READ, FILTERED) \
+			{ \
+				unsigned int pos = (unsigned int)tmpSourceSamplePosition; \
+				float alpha = (float)(tmpSourceSamplePosition - pos), val; \
+				INTERP(READ) \
+				if (FILTERED) val = tsf_voice_lowpass_process(&tmpLowpass, val); \
+				block[n] = val; \
+				tmpSourceSamplePosition += pitchRatio; \
+			}
+		#define TSF_KERNEL(INTERP, LOOPING, FILTERED) \
+			for (n = 0; n != blockSamples; n++) \
+			{ \
+				double limit = (LOOPING && tmpLoopEndDbl - tapsAfter < tmpSampleEndDbl ? tmpLoopEndDbl - tapsAfter : tmpSampleEndDbl), steps = 0; \
+				int run = n; \
+				if (tmpSourceSamplePosition >= tapsBefore && tmpSourceSamplePosition < limit) \
+				{ \
+					/* Point the span at the first tap, the run ends where the last tap leaves it */ \
+					unsigned int runPos = (unsigned int)tmpSourceSamplePosition, firstTap = runPos - tapsBefore; \
+					const short* runData; \
+					const unsigned char* runLow; \
+					if (firstTap - span.start >= span.len) tsf_sample_span_read(f, &span, firstTap); \
+					runData = span.data + (runPos - span.start); \
+					runLow = (span.low ? span.low + (runPos - span.start) : TSF_NULL); \
+					if ((double)span.start + span.len - tapsAfter < limit) limit = (double)span.start + span.len - tapsAfter; \
+					steps = (limit - tmpSourceSamplePosition) / pitchRatio - 1.0; \
+					run = (steps <= 0 ? n : (steps < blockSamples - n ? n + (int)steps : blockSamples)); \
+					INTERP##_RUN(FILTERED) \
+					for (; n != run; n++) TSF_SAMPLE(INTERP, TSF_READ_UNCHECKED, FILTERED) \
+				} \
+				if (n == blockSamples || tmpSourceSamplePosition >= tmpSampleEndDbl) break; \
+				TSF_SAMPLE(INTERP, TSF_READ, FILTERED) \
+				if (LOOPING && tmpSourceSamplePosition >= tmpLoopEndDbl) tmpSourceSamplePosition -= (tmpLoopEnd - tmpLoopStart + 1.0); \
+			}
+		#define TSF_KERNELS(INTERP) \
+			if (isLooping) { if (tmpLowpass.active) TSF_KERNEL(INTERP, 1, 1) else TSF_KERNEL(INTERP, 1, 0) } \
+			else           { if (tmpLowpass.active) TSF_KERNEL(INTERP, 0, 1) else TSF_KERNEL(INTERP, 0, 0) }
+		switch (f->interpolation)
+		{
+			case TSF_INTERPOLATION_NEAREST: TSF_KERNELS(TSF_INTERPOLATE_NEAREST) break;
+			case TSF_INTERPOLATION_LINEAR:  TSF_KERNELS(TSF_INTERPOLATE_LINEAR)  break;
+			case TSF_INTERPOLATION_HERMITE: TSF_KERNELS(TSF_INTERPOLATE_HERMITE) break;
+			default:                        TSF_KERNELS(TSF_INTERPOLATE_SINC)    break; // TSF_INTERPOLATION_SINC8, TSF_INTERPOLATION_SINC16
+		}
+		#undef TSF_KERNELS
+		#undef TSF_KERNEL
+		#undef TSF_SAMPLE
+		#undef TSF_READ_UNCHECKED_AFTER
+		#undef TSF_READ_UNCHECKED_BEFORE
+		#undef TSF_READ_UNCHECKED_AT
+		#undef TSF_READ_RUN
+		#undef TSF_READ_AFTER
+		#undef TSF_READ_BEFORE
+		#undef TSF_READ_AT
+		#undef TSF_TAP_AFTER
+		#undef TSF_TAP_BEFORE
+		#undef TSF_INTERPOLATE_NEAREST
+		#undef TSF_INTERPOLATE_LINEAR
+		#undef TSF_INTERPOLATE_HERMITE
+		#undef TSF_INTERPOLATE_SINC
+		#undef TSF_INTERPOLATE_NEAREST_RUN
+		#undef TSF_INTERPOLATE_LINEAR_RUN
+		#undef TSF_INTERPOLATE_HERMITE_RUN
+		#undef TSF_INTERPOLATE_SINC_RUN
+
+		// Apply gain and panning while mixing it into the output
 		switch (f->outputmode)
 		{
 			case TSF_STEREO_INTERLEAVED:
-				gainLeft = gainMono * v->panFactorLeft, gainRight = gainMono * v->panFactorRight;
-				while (blockSamples-- && tmpSourceSamplePosition < tmpSampleEndDbl)
-				{
-					unsigned int pos = (unsigned int)tmpSourceSamplePosition, nextPos = (pos >= tmpLoopEnd && isLooping ? tmpLoopStart : pos + 1);
-					float inputPos, inputNextPos;
-					inputPos = (float)(tsf_read_short_cached(f, pos) / 32767.0);
-					inputNextPos = (float)(tsf_read_short_cached(f, nextPos) / 32767.0);
-					// Simple linear interpolation.
-					float alpha = (float)(tmpSourceSamplePosition - pos), val = (inputPos * (1.0f - alpha) + inputNextPos * alpha);
-
-					// Low-pass filter.
-					if (tmpLowpass.active) val = tsf_voice_lowpass_process(&tmpLowpass, val);
-
-					*outL++ += val * gainLeft;
-					*outL++ += val * gainRight;
-
-					// Next sample.
-					tmpSourceSamplePosition += pitchRatio;
-					if (tmpSourceSamplePosition >= tmpLoopEndDbl && isLooping) tmpSourceSamplePosition -= (tmpLoopEnd - tmpLoopStart + 1.0);
-				}
+				tsf_mix_interleaved(outL, block, n, gainMono * v->panFactorLeft, gainStep * v->panFactorLeft, gainMono * v->panFactorRight, gainStep * v->panFactorRight);
+				outL += n * 2;
 				break;
 
 			case TSF_STEREO_UNWEAVED:
-				gainLeft = gainMono * v->panFactorLeft, gainRight = gainMono * v->panFactorRight;
-				while (blockSamples-- && tmpSourceSamplePosition < tmpSampleEndDbl)
-				{
-					unsigned int pos = (unsigned int)tmpSourceSamplePosition, nextPos = (pos >= tmpLoopEnd && isLooping ? tmpLoopStart : pos + 1);
-					float inputPos, inputNextPos;
-					inputPos = (float)(tsf_read_short_cached(f, pos) / 32767.0);
-					inputNextPos = (float)(tsf_read_short_cached(f, nextPos) / 32767.0);
-
-					// Simple linear interpolation.
-					float alpha = (float)(tmpSourceSamplePosition - pos), val = (inputPos * (1.0f - alpha) + inputNextPos * alpha);
-
-					// Low-pass filter.
-					if (tmpLowpass.active) val = tsf_voice_lowpass_process(&tmpLowpass, val);
-
-					*outL++ += val * gainLeft;
-					*outR++ += val * gainRight;
-
-					// Next sample.
-					tmpSourceSamplePosition += pitchRatio;
-					if (tmpSourceSamplePosition >= tmpLoopEndDbl && isLooping) tmpSourceSamplePosition -= (tmpLoopEnd - tmpLoopStart + 1.0);
-				}
+				tsf_mix_unweaved(outL, outR, block, n, gainMono * v->panFactorLeft, gainStep * v->panFactorLeft, gainMono * v->panFactorRight, gainStep * v->panFactorRight);
+				outL += n;
+				outR += n;
 				break;
 
 			case TSF_MONO:
-				while (blockSamples-- && tmpSourceSamplePosition < tmpSampleEndDbl)
-				{
-					unsigned int pos = (unsigned int)tmpSourceSamplePosition, nextPos = (pos >= tmpLoopEnd && isLooping ? tmpLoopStart : pos + 1);
-					float inputPos, inputNextPos;
-					inputPos = (float)(tsf_read_short_cached(f, pos) / 32767.0);
-					inputNextPos = (float)(tsf_read_short_cached(f, nextPos) / 32767.0);
-
-					// Simple linear interpolation.
-					float alpha = (float)(tmpSourceSamplePosition - pos), val = (inputPos * (1.0f - alpha) + inputNextPos * alpha);
-
-					// Low-pass filter.
-					if (tmpLowpass.active) val = tsf_voice_lowpass_process(&tmpLowpass, val);
-
-					*outL++ += val * gainMono;
-
-					// Next sample.
-					tmpSourceSamplePosition += pitchRatio;
-					if (tmpSourceSamplePosition >= tmpLoopEndDbl && isLooping) tmpSourceSamplePosition -= (tmpLoopEnd - tmpLoopStart + 1.0);
-				}
+				tsf_mix_mono(outL, block, n, gainMono, gainStep);
+				outL += n;
 				break;
 		}
 
 		if (tmpSourceSamplePosition >= tmpSampleEndDbl || v->ampenv.segment == TSF_SEGMENT_DONE)
 		{
-			tsf_voice_kill(v);
+			tsf_voice_kill(f, v);
 			return;
 		}
 	}
@@ -1256,109 +2377,271 @@ static void tsf_voice_render(tsf* f, struct tsf_voice* v, float* outputBuffer, i
 }
 
 
-void DumpF32P32(char *name, long long x) {
-  printf("%s = %08x.%08x\n", name, (int32_t)((x>>32)&0xffffffff), (int32_t)(x&0xffffffff));
+// Fixed point rendering for systems without an FPU (tsf_render_short_fast).
+// Envelopes, LFOs and modulated pitch and filter are still updated with floating point once per block
+// but all per-sample processing uses integers: the playback position is 32.32, sample values Q23,
+// gains Q24 and filter coefficients Q28. The position and filter state stay in the voice as integers
+// and are only converted when a voice switches between tsf_render_float and tsf_render_short_fast.
+#define TSF_FIXED_MUL(a, b, shift) ((int32_t)(((int64_t)(a) * (b)) >> (shift)))
+#define TSF_FIXED_MUL_ROUND(a, b, shift) ((int32_t)(((int64_t)(a) * (b) + ((int64_t)1 << ((shift) - 1))) >> (shift)))
+
+static void tsf_voice_lowpass_fixed_setup(struct tsf_voice_lowpass_fixed* e, const struct tsf_voice_lowpass* lp)
+{
+	e->a0 = (int32_t)(lp->a0 * 268435456.0);
+	e->a1 = (int32_t)(lp->a1 * 268435456.0);
+	e->b1 = (int32_t)(lp->b1 * 268435456.0);
+	e->b2 = (int32_t)(lp->b2 * 268435456.0);
+}
+
+// Move the position and filter state of a voice to the fixed point fields, they stay there
+// while the voice is only rendered by tsf_render_short_fast
+static void tsf_voice_state_to_fixed(struct tsf_voice* v)
+{
+	v->sourceSamplePositionFixed = (fixed32p32)(v->sourceSamplePosition * 4294967296.0);
+	v->lowpassFixed.z1 = (int64_t)(v->lowpass.z1 * 2251799813685248.0);
+	v->lowpassFixed.z2 = (int64_t)(v->lowpass.z2 * 2251799813685248.0);
+	if (v->lowpass.active) tsf_voice_lowpass_fixed_setup(&v->lowpassFixed, &v->lowpass);
+	v->fixedState = TSF_TRUE;
+}
+
+// Move them back before rendering the voice with floating point
+static void tsf_voice_state_to_float(struct tsf_voice* v)
+{
+	v->sourceSamplePosition = v->sourceSamplePositionFixed * (1.0 / 4294967296.0);
+	v->lowpass.z1 = v->lowpassFixed.z1 * (1.0 / 2251799813685248.0);
+	v->lowpass.z2 = v->lowpassFixed.z2 * (1.0 / 2251799813685248.0);
+	v->fixedState = TSF_FALSE;
+}
+
+// Q24 gain, int32 can't hold gains of 128 (+42 dB) and above
+static int32_t tsf_fixed_gain(float g) { return (int32_t)((g < 127.0f ? g : 127.0f) * 16777216.0f); }
+
+static int32_t tsf_voice_lowpass_fixed_process(struct tsf_voice_lowpass_fixed* e, int32_t In)
+{
+	// The state is kept at the full Q51 precision of the products
+	int32_t Out = (int32_t)(((int64_t)In * e->a0 + e->z1) >> 28);
+	e->z1 = (int64_t)In * e->a1 + e->z2 - (int64_t)Out * e->b1;
+	e->z2 = (int64_t)In * e->a0 - (int64_t)Out * e->b2;
+	return Out;
+}
+
+// Read the sample at 'pos' as Q23
+static int32_t tsf_sample_span_fixed(tsf *f, struct tsf_sample_span* s, unsigned int pos)
+{
+	short hi = tsf_sample_span_read(f, s, pos);
+	return (s->low ? hi * 256 + s->low[pos - s->start] : hi * 256);
+}
+
+static short tsf_saturate16(int32_t v) { return (short)(v < -32768 ? -32768 : (v > 32767 ? 32767 : v)); }
+
+// Saturating mix of 'n' Q23 samples with the ramped Q24 gains, matching tsf_mix_mono, tsf_mix_unweaved and tsf_mix_interleaved
+static void tsf_mix_mono_fixed(short* out, const int32_t* in, int n, int32_t gain, int32_t step)
+{
+	int i;
+	for (i = 0; i != n; i++, gain += step)
+		out[i] = tsf_saturate16(out[i] + TSF_FIXED_MUL_ROUND(in[i], gain, 32));
+}
+
+static void tsf_mix_unweaved_fixed(short* outL, short* outR, const int32_t* in, int n, int32_t gainL, int32_t stepL, int32_t gainR, int32_t stepR)
+{
+	int i;
+	for (i = 0; i != n; i++, gainL += stepL, gainR += stepR)
+	{
+		outL[i] = tsf_saturate16(outL[i] + TSF_FIXED_MUL_ROUND(in[i], gainL, 32));
+		outR[i] = tsf_saturate16(outR[i] + TSF_FIXED_MUL_ROUND(in[i], gainR, 32));
+	}
+}
+
+static void tsf_mix_interleaved_fixed(short* out, const int32_t* in, int n, int32_t gainL, int32_t stepL, int32_t gainR, int32_t stepR)
+{
+	int i;
+	for (i = 0; i != n; i++, gainL += stepL, gainR += stepR)
+	{
+		out[i * 2]     = tsf_saturate16(out[i * 2]     + TSF_FIXED_MUL_ROUND(in[i], gainL, 32));
+		out[i * 2 + 1] = tsf_saturate16(out[i * 2 + 1] + TSF_FIXED_MUL_ROUND(in[i], gainR, 32));
+	}
 }
+
 static void tsf_voice_render_fast(tsf* f, struct tsf_voice* v, short* outputBuffer, int numSamples)
 {
-  struct tsf_region* region = v->region;
-  short* outL = outputBuffer;
-  short* outR = (f->outputmode == TSF_STEREO_UNWEAVED ? outL + numSamples : TSF_NULL);
-
-  // Cache some values, to give them at least some chance of ending up in registers.
-  TSF_BOOL updateModEnv = (region->modEnvToPitch || region->modEnvToFilterFc);
-  TSF_BOOL updateModLFO = (v->modlfo.delta && (region->modLfoToPitch || region->modLfoToFilterFc || region->modLfoToVolume));
-  TSF_BOOL updateVibLFO = (v->viblfo.delta && (region->vibLfoToPitch));
-  TSF_BOOL isLooping    = (v->loopStart < v->loopEnd);
-  unsigned int tmpLoopStart = v->loopStart, tmpLoopEnd = v->loopEnd;
-  //double tmpSampleEndDbl = (double)v->sampleEnd, tmpLoopEndDbl = (double)tmpLoopEnd + 1.0;
-  //double tmpSourceSamplePosition = v->sourceSamplePosition;
-  fixed32p32 tmpSampleEndF32P32 = ((fixed32p32)(v->sampleEnd)) << 32;
-  fixed32p32 tmpLoopEndF32P32 = ((fixed32p32)(tmpLoopEnd + 1)) << 32;
-  fixed32p32 tmpSourceSamplePositionF32P32 = v->sourceSamplePositionF32P32;
-  struct tsf_voice_lowpass tmpLowpass = v->lowpass;
-
-  TSF_BOOL dynamicLowpass = (region->modLfoToFilterFc || region->modEnvToFilterFc);
-  float tmpSampleRate, tmpInitialFilterFc, tmpModLfoToFilterFc, tmpModEnvToFilterFc;
-
-  TSF_BOOL dynamicPitchRatio = (region->modLfoToPitch || region->modEnvToPitch || region->vibLfoToPitch);
-  //double pitchRatio;
-  fixed32p32 pitchRatioF32P32;
-  float tmpModLfoToPitch, tmpVibLfoToPitch, tmpModEnvToPitch;
-
-  TSF_BOOL dynamicGain = (region->modLfoToVolume != 0);
-  float noteGain, tmpModLfoToVolume;
-
-  if (dynamicLowpass) tmpSampleRate = f->outSampleRate, tmpInitialFilterFc = (float)region->initialFilterFc, tmpModLfoToFilterFc = (float)region->modLfoToFilterFc, tmpModEnvToFilterFc = (float)region->modEnvToFilterFc;
-  else tmpSampleRate = 0, tmpInitialFilterFc = 0, tmpModLfoToFilterFc = 0, tmpModEnvToFilterFc = 0;
-
-  if (dynamicPitchRatio) pitchRatioF32P32 = 0, tmpModLfoToPitch = (float)region->modLfoToPitch, tmpVibLfoToPitch = (float)region->vibLfoToPitch, tmpModEnvToPitch = (float)region->modEnvToPitch;
-  else {
-    double pr = tsf_timecents2Secsd(v->pitchInputTimecents) * v->pitchOutputFactor;
-    fixed32p32 adj = 1LL<<32;
-    pr *= adj;
-    pitchRatioF32P32 = (int64_t)pr, tmpModLfoToPitch = 0, tmpVibLfoToPitch = 0, tmpModEnvToPitch = 0;
-  }
-
-  if (dynamicGain) noteGain = 0, tmpModLfoToVolume = (float)region->modLfoToVolume * 0.1f;
-  else noteGain = tsf_decibelsToGain(v->noteGainDB), tmpModLfoToVolume = 0;
-
-  while (numSamples)
-  {
-    float gainMono;
-    int blockSamples = (numSamples > TSF_RENDER_EFFECTSAMPLEBLOCK ? TSF_RENDER_EFFECTSAMPLEBLOCK : numSamples);
-    numSamples -= blockSamples;
-
-    if (dynamicLowpass)
-    {
-      float fres = tmpInitialFilterFc + v->modlfo.level * tmpModLfoToFilterFc + v->modenv.level * tmpModEnvToFilterFc;
-      tmpLowpass.active = (fres <= 13500.0f);
-      if (tmpLowpass.active) tsf_voice_lowpass_setup(&tmpLowpass, tsf_cents2Hertz(fres) / tmpSampleRate);
-    }
-
-    if (dynamicPitchRatio) {
-      pitchRatioF32P32 = tsf_timecents2Secsd(v->pitchInputTimecents + (v->modlfo.level * tmpModLfoToPitch + v->viblfo.level * tmpVibLfoToPitch + v->modenv.level * tmpModEnvToPitch)) * v->pitchOutputFactor * (1LL<<32);
-   }
-
-    if (dynamicGain)
-      noteGain = tsf_decibelsToGain(v->noteGainDB + (v->modlfo.level * tmpModLfoToVolume));
-
-    gainMono = noteGain * v->ampenv.level;
-    short gainMonoFP = gainMono * 32767;
-    
-    // Update EG.
-    tsf_voice_envelope_process(&v->ampenv, blockSamples, f->outSampleRate);
-    if (updateModEnv) tsf_voice_envelope_process(&v->modenv, blockSamples, f->outSampleRate);
-
-    // Update LFOs.
-    if (updateModLFO) tsf_voice_lfo_process(&v->modlfo, blockSamples);
-    if (updateVibLFO) tsf_voice_lfo_process(&v->viblfo, blockSamples);
-
-    while (blockSamples-- && tmpSourceSamplePositionF32P32 < tmpSampleEndF32P32)
-    {
-      unsigned int pos = (unsigned int)(tmpSourceSamplePositionF32P32>>32);
-      short val = tsf_read_short_cached(f, pos);
-      int32_t val32 = (int)val * (int)gainMonoFP;
-
-      *outL++ += val32>>16;
-      if (f->outputmode != TSF_MONO) *outR++ += val32>>16;
-
-      // Next sample.
-      tmpSourceSamplePositionF32P32 += pitchRatioF32P32;
-      if (tmpSourceSamplePositionF32P32 >= tmpLoopEndF32P32 && isLooping)
-        tmpSourceSamplePositionF32P32 -= (tmpLoopEndF32P32 - tmpLoopStart + (1LL<<32));
-    }
-
-    if (tmpSourceSamplePositionF32P32 >= tmpSampleEndF32P32 || v->ampenv.segment == TSF_SEGMENT_DONE)
-    {
-      tsf_voice_kill(v);
-      return;
-    }
-  }
-
-  v->sourceSamplePositionF32P32 = tmpSourceSamplePositionF32P32;
-  if (tmpLowpass.active || dynamicLowpass) v->lowpass = tmpLowpass;
+	struct tsf_region* region = v->region;
+	short* outL = outputBuffer;
+	short* outR = (f->outputmode == TSF_STEREO_UNWEAVED ? outL + numSamples : TSF_NULL);
+
+	// Cache some values, to give them at least some chance of ending up in registers.
+	TSF_BOOL updateModEnv = (region->modEnvToPitch || region->modEnvToFilterFc);
+	TSF_BOOL updateModLFO = (v->modlfo.delta && (region->modLfoToPitch || region->modLfoToFilterFc || region->modLfoToVolume));
+	TSF_BOOL updateVibLFO = (v->viblfo.delta && (region->vibLfoToPitch));
+	TSF_BOOL isLooping    = (v->loopStart < v->loopEnd);
+	unsigned int tmpLoopStart = v->loopStart, tmpLoopEnd = v->loopEnd;
+	fixed32p32 tmpSampleEnd = (fixed32p32)v->sampleEnd << 32, tmpLoopEndPos = (fixed32p32)(tmpLoopEnd + 1) << 32;
+	fixed32p32 tmpLoopLength = (fixed32p32)(tmpLoopEnd - tmpLoopStart + 1) << 32;
+	fixed32p32 tmpSourceSamplePosition = v->sourceSamplePositionFixed;
+	struct tsf_voice_lowpass tmpLowpass = v->lowpass;
+	struct tsf_voice_lowpass_fixed tmpLowpassFixed = v->lowpassFixed;
+	struct tsf_sample_span span = { TSF_NULL, TSF_NULL, 0, 0 };
+
+	// Number of samples the interpolation reads before and after the current one
+	unsigned int tapsBefore = (f->interpolation == TSF_INTERPOLATION_HERMITE ? 1 : f->interpolation >= TSF_INTERPOLATION_SINC8 ? f->sincTaps / 2 - 1 : 0);
+	unsigned int tapsAfter = (f->interpolation == TSF_INTERPOLATION_HERMITE ? 2 : f->interpolation >= TSF_INTERPOLATION_SINC8 ? f->sincTaps / 2 : 1);
+
+	TSF_BOOL dynamicLowpass = (region->modLfoToFilterFc || region->modEnvToFilterFc);
+	float tmpSampleRate, tmpInitialFilterFc, tmpModLfoToFilterFc, tmpModEnvToFilterFc;
+
+	TSF_BOOL dynamicPitchRatio = (region->modLfoToPitch || region->modEnvToPitch || region->vibLfoToPitch);
+	fixed32p32 pitchRatio;
+	float tmpModLfoToPitch, tmpVibLfoToPitch, tmpModEnvToPitch;
+
+	TSF_BOOL dynamicGain = (region->modLfoToVolume != 0);
+	float noteGain, tmpModLfoToVolume;
+
+	if (dynamicLowpass) tmpSampleRate = f->outSampleRate, tmpInitialFilterFc = (float)region->initialFilterFc, tmpModLfoToFilterFc = (float)region->modLfoToFilterFc, tmpModEnvToFilterFc = (float)region->modEnvToFilterFc;
+	else tmpSampleRate = 0, tmpInitialFilterFc = 0, tmpModLfoToFilterFc = 0, tmpModEnvToFilterFc = 0;
+
+	if (dynamicPitchRatio) pitchRatio = 0, tmpModLfoToPitch = (float)region->modLfoToPitch, tmpVibLfoToPitch = (float)region->vibLfoToPitch, tmpModEnvToPitch = (float)region->modEnvToPitch;
+	else pitchRatio = v->pitchRatioFixed, tmpModLfoToPitch = 0, tmpVibLfoToPitch = 0, tmpModEnvToPitch = 0;
+
+	if (dynamicGain) tmpModLfoToVolume = (float)region->modLfoToVolume * 0.1f, noteGain = tsf_decibelsToGain(v->noteGainDB + (v->modlfo.level * tmpModLfoToVolume));
+	else noteGain = tsf_decibelsToGain(v->noteGainDB), tmpModLfoToVolume = 0;
+
+	while (numSamples)
+	{
+		float gainMono, gainEnd;
+		int32_t block[TSF_RENDER_EFFECTSAMPLEBLOCK], gainL, gainR;
+		int n, blockSamples = (numSamples > TSF_RENDER_EFFECTSAMPLEBLOCK ? TSF_RENDER_EFFECTSAMPLEBLOCK : numSamples);
+		numSamples -= blockSamples;
+
+		if (dynamicLowpass)
+		{
+			float fres = tmpInitialFilterFc + v->modlfo.level * tmpModLfoToFilterFc + v->modenv.level * tmpModEnvToFilterFc;
+			tmpLowpass.active = (fres <= 13500.0f);
+			if (tmpLowpass.active) tsf_voice_lowpass_setup(&tmpLowpass, tsf_cents2Hertz(fres) / tmpSampleRate), tsf_voice_lowpass_fixed_setup(&tmpLowpassFixed, &tmpLowpass);
+		}
+
+		if (dynamicPitchRatio)
+			pitchRatio = (fixed32p32)(tsf_timecents2Secsd(v->pitchInputTimecents + (v->modlfo.level * tmpModLfoToPitch + v->viblfo.level * tmpVibLfoToPitch + v->modenv.level * tmpModEnvToPitch)) * v->pitchOutputFactor * 4294967296.0);
+
+		gainMono = noteGain * v->ampenv.level;
+
+		// Load the samples of this block now, this also invalidates the span.
+		{
+			unsigned int pos = (unsigned int)(tmpSourceSamplePosition >> 32), before = (pos < tapsBefore ? pos : tapsBefore);
+			tsf_voice_prefetch(f, v, pos - before, (unsigned int)((pitchRatio * blockSamples) >> 32) + before + tapsAfter);
+		}
+		span.len = 0;
+
+		// Update EG.
+		tsf_voice_envelope_process(&v->ampenv, blockSamples, f->outSampleRate);
+		if (updateModEnv) tsf_voice_envelope_process(&v->modenv, blockSamples, f->outSampleRate);
+
+		// Update LFOs.
+		if (updateModLFO) tsf_voice_lfo_process(&v->modlfo, blockSamples);
+		if (updateVibLFO) tsf_voice_lfo_process(&v->viblfo, blockSamples);
+
+		// Ramp the gain to where the envelope and LFO are at the end of the block
+		if (dynamicGain)
+			noteGain = tsf_decibelsToGain(v->noteGainDB + (v->modlfo.level * tmpModLfoToVolume));
+		gainEnd = noteGain * v->ampenv.level;
+
+		// Interpolate the samples of this block into a mono buffer
+		// Position of the sample 'k' samples before or after 'pos', following the loop
+		#define TSF_TAP_BEFORE(k) (pos >= (unsigned int)(k) ? pos - (k) : 0)
+		#define TSF_TAP_AFTER(k) (pos + (k) > tmpLoopEnd && isLooping ? pos + (k) - (tmpLoopEnd - tmpLoopStart + 1) : pos + (k))
+		#define TSF_GENERATE_BEGIN \
+			for (n = 0; n != blockSamples && tmpSourceSamplePosition < tmpSampleEnd; n++) \
+			{ \
+				unsigned int pos = (unsigned int)(tmpSourceSamplePosition >> 32), frac = (unsigned int)tmpSourceSamplePosition; \
+				int32_t val;
+		#define TSF_GENERATE_END \
+				block[n] = val; \
+				tmpSourceSamplePosition += pitchRatio; \
+				if (tmpSourceSamplePosition >= tmpLoopEndPos && isLooping) tmpSourceSamplePosition -= tmpLoopLength; \
+			}
+		switch (f->interpolation)
+		{
+			case TSF_INTERPOLATION_NEAREST:
+				TSF_GENERATE_BEGIN
+					val = tsf_sample_span_fixed(f, &span, (frac < 0x80000000u ? pos : TSF_TAP_AFTER(1)));
+				TSF_GENERATE_END
+				break;
+
+			case TSF_INTERPOLATION_LINEAR:
+				TSF_GENERATE_BEGIN
+					int32_t alpha = (int32_t)(frac >> 17);
+					int32_t inputPos = tsf_sample_span_fixed(f, &span, pos), inputNextPos = tsf_sample_span_fixed(f, &span, TSF_TAP_AFTER(1));
+					val = inputPos + TSF_FIXED_MUL(inputNextPos - inputPos, alpha, 15);
+				TSF_GENERATE_END
+				break;
+
+			case TSF_INTERPOLATION_HERMITE:
+				TSF_GENERATE_BEGIN
+					int32_t alpha = (int32_t)(frac >> 17);
+					int32_t ym1 = tsf_sample_span_fixed(f, &span, TSF_TAP_BEFORE(1)), y0 = tsf_sample_span_fixed(f, &span, pos);
+					int32_t y1 = tsf_sample_span_fixed(f, &span, TSF_TAP_AFTER(1)), y2 = tsf_sample_span_fixed(f, &span, TSF_TAP_AFTER(2));
+					int32_t c1 = (y1 - ym1) / 2, c2 = ym1 - (5 * y0) / 2 + 2 * y1 - y2 / 2, c3 = (y2 - ym1) / 2 + (3 * (y0 - y1)) / 2;
+					val = TSF_FIXED_MUL(TSF_FIXED_MUL(TSF_FIXED_MUL(c3, alpha, 15) + c2, alpha, 15) + c1, alpha, 15) + y0;
+				TSF_GENERATE_END
+				break;
+
+			default: // TSF_INTERPOLATION_SINC8, TSF_INTERPOLATION_SINC16
+				TSF_GENERATE_BEGIN
+					const int32_t* coeffs = f->sincTableFixed + (int)(((int64_t)frac * TSF_SINC_PHASES + 0x80000000u) >> 32) * f->sincTaps;
+					int k, taps = f->sincTaps, first = 1 - taps / 2;
+					int64_t sum = 0;
+					for (k = 0; k != -first; k++) sum += (int64_t)tsf_sample_span_fixed(f, &span, TSF_TAP_BEFORE(-first - k)) * coeffs[k];
+					for (; k != taps; k++) sum += (int64_t)tsf_sample_span_fixed(f, &span, TSF_TAP_AFTER(first + k)) * coeffs[k];
+					val = (int32_t)(sum >> 30);
+				TSF_GENERATE_END
+				break;
+		}
+		#undef TSF_TAP_AFTER
+		#undef TSF_TAP_BEFORE
+		#undef TSF_GENERATE_BEGIN
+		#undef TSF_GENERATE_END
+
+		if (tmpLowpass.active)
+		{
+			int i;
+			for (i = 0; i != n; i++) block[i] = tsf_voice_lowpass_fixed_process(&tmpLowpassFixed, block[i]);
+		}
+
+		// Apply gain and panning while mixing it into the output
+		switch (f->outputmode)
+		{
+			// Ramp between the clamped gains at the start and end of the block
+			case TSF_STEREO_INTERLEAVED:
+				gainL = tsf_fixed_gain(gainMono * v->panFactorLeft), gainR = tsf_fixed_gain(gainMono * v->panFactorRight);
+				tsf_mix_interleaved_fixed(outL, block, n, gainL, (tsf_fixed_gain(gainEnd * v->panFactorLeft) - gainL) / blockSamples, gainR, (tsf_fixed_gain(gainEnd * v->panFactorRight) - gainR) / blockSamples);
+				outL += n * 2;
+				break;
+
+			case TSF_STEREO_UNWEAVED:
+				gainL = tsf_fixed_gain(gainMono * v->panFactorLeft), gainR = tsf_fixed_gain(gainMono * v->panFactorRight);
+				tsf_mix_unweaved_fixed(outL, outR, block, n, gainL, (tsf_fixed_gain(gainEnd * v->panFactorLeft) - gainL) / blockSamples, gainR, (tsf_fixed_gain(gainEnd * v->panFactorRight) - gainR) / blockSamples);
+				outL += n;
+				outR += n;
+				break;
+
+			case TSF_MONO:
+				gainL = tsf_fixed_gain(gainMono);
+				tsf_mix_mono_fixed(outL, block, n, gainL, (tsf_fixed_gain(gainEnd) - gainL) / blockSamples);
+				outL += n;
+				break;
+		}
+
+		if (tmpSourceSamplePosition >= tmpSampleEnd || v->ampenv.segment == TSF_SEGMENT_DONE)
+		{
+			tsf_voice_kill(f, v);
+			return;
+		}
+	}
+
+	v->sourceSamplePositionFixed = tmpSourceSamplePosition;
+	v->lowpassFixed = tmpLowpassFixed;
+	if (dynamicLowpass) v->lowpass = tmpLowpass;
 }
+#undef TSF_FIXED_MUL
+#undef TSF_FIXED_MUL_ROUND
 
 
 
@@ -1371,6 +2654,7 @@ TSFDEF tsf* tsf_load(struct tsf_stream* stream)
 	struct tsf_hydra hydra;
 	int fontSamplesOffset = 0;
 	int fontSampleCount = 0;
+	int fontSamples24Offset = 0;
 
 	if (!tsf_riffchunk_read(TSF_NULL, &chunkHead, stream) || !TSF_FourCCEquals(chunkHead.id, "sfbk"))
 	{
@@ -1416,6 +2700,12 @@ TSFDEF tsf* tsf_load(struct tsf_stream* stream)
 				{
 					tsf_load_samples(&fontSamplesOffset, &fontSampleCount, &chunk, stream);
 				}
+				else if (TSF_FourCCEquals(chunk.id, "sm24") && fontSampleCount && chunk.size >= (unsigned int)fontSampleCount)
+				{
+					// Low bytes of 24-bit samples, only used if it comes after (and matches) the smpl chunk
+					fontSamples24Offset = stream->tell(stream->data);
+					stream->skip(stream->data, chunk.size);
+				}
 				else stream->skip(stream->data, chunk.size);
 			}
 		}
@@ -1432,27 +2722,41 @@ TSFDEF tsf* tsf_load(struct tsf_stream* stream)
 	else
 	{
 		res = (tsf*)TSF_MALLOC(sizeof(tsf));
+		if (!res) return TSF_NULL;
 		TSF_MEMSET(res, 0, sizeof(tsf));
 		res->presetNum = hydra.phdrNum - 1;
 		res->presets = (struct tsf_preset*)TSF_MALLOC(res->presetNum * sizeof(struct tsf_preset));
+		if (!res->presets) goto error;
 		TSF_MEMSET(res->presets, 0, res->presetNum * sizeof(struct tsf_preset));
 		res->fontSamplesOffset = fontSamplesOffset;
 		res->fontSampleCount = fontSampleCount;
+		res->fontSamples24Offset = fontSamples24Offset;
 		res->outSampleRate = 44100.0f;
+		res->interpolation = TSF_INTERPOLATION_LINEAR;
 		res->hydra = (struct tsf_hydra*)TSF_MALLOC(sizeof(struct tsf_hydra));
+		if (!res->hydra) goto error;
 		TSF_MEMCPY(res->hydra, &hydra, sizeof(*res->hydra));
 		res->hydra->stream = (struct tsf_stream*)TSF_MALLOC(sizeof(struct tsf_stream));
+		if (!res->hydra->stream) goto error;
 		TSF_MEMCPY(res->hydra->stream, stream, sizeof(*res->hydra->stream));
+		if (!tsf_load_compressed(res)) goto error;
+		tsf_load_presetindex(res, res->hydra);
+		res->presetRequests = (int*)TSF_MALLOC((res->presetNum + 1) * sizeof(int));
+		if (!res->presetRequests) goto error;
 
 		// Cached sample
-		for (int i=0; i<TSF_BUFFS; i++) {
-			res->buffer[i] = (short*)TSF_MALLOC(TSF_BUFFSIZE * sizeof(short));
-			res->offset[i] = 0xfffffff;
-			res->timestamp[i] = -1;
-		}
-		res->epoch = 0;
+		if (!tsf_sample_cache_init(&res->cache, TSF_BUFFS, TSF_BUFFSIZE, res->fontSamples24Offset != 0)) goto error;
 	}
 	return res;
+
+error:
+	if (res->hydra) TSF_FREE(res->hydra->stream);
+	TSF_FREE(res->hydra);
+	TSF_FREE(res->presetRequests);
+	TSF_FREE(res->compressed);
+	TSF_FREE(res->presets);
+	TSF_FREE(res);
+	return TSF_NULL;
 }
 
 TSFDEF void tsf_close(tsf* f)
@@ -1460,14 +2764,25 @@ TSFDEF void tsf_close(tsf* f)
 	struct tsf_preset *preset, *presetEnd;
 	if (!f) return;
 	for (preset = f->presets, presetEnd = preset + f->presetNum; preset != presetEnd; preset++)
-		TSF_FREE(preset->regions);
+	{
+		if (!f->bankRegions) TSF_FREE(preset->regions);
+		TSF_FREE(preset->keyRegions);
+	}
+	TSF_FREE(f->bankRegionsAlloc);
 	TSF_FREE(f->presets);
+	TSF_FREE(f->presetRequests);
 	TSF_FREE(f->voices);
-	TSF_FREE(f->outputSamples);
+	TSF_FREE(f->activeVoices);
+	TSF_FREE(f->freeVoices);
+	TSF_FREE(f->sincTable);
+	tsf_hydra_free_records(f->hydra);
 	f->hydra->stream->close(f->hydra->stream->data);
 	TSF_FREE(f->hydra->stream);
 	TSF_FREE(f->hydra);
-	for (int i=0; i<TSF_BUFFS; i++) TSF_FREE(f->buffer[i]);
+	tsf_sample_cache_free(&f->cache);
+	TSF_FREE(f->fontSamplesAlloc);
+	tsf_set_sample_decoder(f, TSF_NULL);
+	TSF_FREE(f->compressed);
 	TSF_FREE(f);
 }
 
@@ -1478,10 +2793,370 @@ TSFDEF int tsf_get_presetcount(tsf* f)
 
 TSFDEF const char* tsf_get_presetname(tsf* f, int preset)
 {
-	if (f->presets[preset].regions == NULL && preset >= 0 && preset < f->presetNum) tsf_load_preset(f, f->hydra, preset);
 	return (preset < 0 || preset >= f->presetNum ? TSF_NULL : f->presets[preset].presetName);
 }
 
+TSFDEF int tsf_get_presetindex(const tsf* f, int bank, int preset_number)
+{
+	int lo = 0, hi = f->presetNum;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		const struct tsf_preset* p = &f->presets[mid];
+		if (p->bank < bank || (p->bank == bank && p->preset < preset_number)) lo = mid + 1;
+		else hi = mid;
+	}
+	return (lo < f->presetNum && f->presets[lo].bank == bank && f->presets[lo].preset == preset_number ? lo : -1);
+}
+
+TSFDEF int tsf_set_sample_cache(tsf* f, int blocks, int blockSize)
+{
+	struct tsf_sample_cache cache;
+	if (f->cache.streaming || f->fontSamples || blocks < 1 || blockSize < 1 || !tsf_sample_cache_init(&cache, blocks, blockSize, f->fontSamples24Offset != 0)) return 0;
+	cache.stats = f->cache.stats;
+	tsf_sample_cache_free(&f->cache);
+	f->cache = cache;
+	return 1;
+}
+
+TSFDEF void tsf_get_cache_stats(tsf* f, struct tsf_cache_stats* stats, int flag_reset)
+{
+	*stats = f->cache.stats;
+	if (flag_reset) TSF_MEMSET(&f->cache.stats, 0, sizeof(f->cache.stats));
+}
+
+// Load the presets queued by tsf_preload_presets_async
+static int tsf_preset_service(tsf* f)
+{
+	int tail = TSF_ATOMIC_LOAD(&f->presetRequestTail), loaded = 0;
+	for (; f->presetRequestHead != tail; loaded++)
+	{
+		struct tsf_preset* preset = &f->presets[f->presetRequests[f->presetRequestHead]];
+		tsf_load_preset(f, f->hydra, (int)(preset - f->presets));
+		TSF_ATOMIC_STORE(&preset->loadState, TSF_PRESET_LOADED);
+		f->presetRequestHead = (f->presetRequestHead + 1) % (f->presetNum + 1);
+	}
+	return loaded;
+}
+
+TSFDEF int tsf_get_presetloaded(tsf* f, int preset)
+{
+	return (preset >= 0 && preset < f->presetNum && TSF_ATOMIC_LOAD(&f->presets[preset].loadState) == TSF_PRESET_LOADED);
+}
+
+TSFDEF int tsf_preload_presets(tsf* f, const int* presets, int num)
+{
+	int i, res = 1;
+	if (!presets) num = f->presetNum;
+	for (i = 0; i != num; i++)
+	{
+		int preset = (presets ? presets[i] : i);
+		if (preset < 0 || preset >= f->presetNum || f->presets[preset].loadState != TSF_PRESET_UNLOADED) continue;
+		if (!tsf_load_preset(f, f->hydra, preset)) res = 0;
+		f->presets[preset].loadState = TSF_PRESET_LOADED;
+	}
+	return res;
+}
+
+TSFDEF int tsf_preload_presets_async(tsf* f, const int* presets, int num)
+{
+	int i, queued = 0;
+	if (f->cache.streaming) return 0; // all presets are loaded already
+	if (!f->hydra->memory && !tsf_preload_hydra(f)) return -1;
+	if (!presets) num = f->presetNum;
+	for (i = 0; i != num; i++)
+	{
+		int preset = (presets ? presets[i] : i);
+		if (preset < 0 || preset >= f->presetNum || f->presets[preset].loadState != TSF_PRESET_UNLOADED) continue;
+		f->presets[preset].loadState = TSF_PRESET_QUEUED;
+		f->presetRequests[f->presetRequestTail] = preset;
+		TSF_ATOMIC_STORE(&f->presetRequestTail, (f->presetRequestTail + 1) % (f->presetNum + 1));
+		queued++;
+	}
+	return queued;
+}
+
+TSFDEF void tsf_set_streaming(tsf* f, int flag_enable)
+{
+	if (flag_enable)
+	{
+		// Load all presets beforehand so the render thread never reads from the stream
+		tsf_preset_service(f);
+		tsf_preload_presets(f, TSF_NULL, 0);
+		f->cache.streaming = TSF_TRUE;
+	}
+	else
+	{
+		// Finish the blocks still in the queue
+		tsf_stream_service(f);
+		f->cache.streaming = TSF_FALSE;
+	}
+}
+
+TSFDEF int tsf_stream_service(tsf* f)
+{
+	struct tsf_sample_cache* c = &f->cache;
+	int tail = TSF_ATOMIC_LOAD(&c->requestTail), loaded = tsf_preset_service(f);
+	for (; c->requestHead != tail; loaded++)
+	{
+		struct tsf_stream_request r = c->requests[c->requestHead];
+		tsf_cache_load(f, r.block, r.offset);
+		TSF_ATOMIC_STORE(&c->ready[r.block], TSF_TRUE);
+		c->requestHead = (c->requestHead + 1) % c->requestNum;
+	}
+	return loaded;
+}
+
+// Use sample data that is already in memory, 'avail' samples can be read from 'samples'
+// (and from 'low' for the low bytes of 24-bit samples if not NULL)
+static void tsf_set_resident_samples(tsf* f, const short* samples, const unsigned char* low, int avail)
+{
+	f->fontSamples = samples;
+	f->fontSamples24 = low;
+	f->fontSamplesAvail = avail;
+
+	// The cache isn't needed anymore
+	tsf_sample_cache_free(&f->cache);
+	TSF_MEMSET(&f->cache, 0, sizeof(f->cache));
+}
+
+TSFDEF int tsf_preload_hydra(tsf* f)
+{
+	if (f->hydra->phdrs) return 1;
+	if (f->cache.streaming) return 0;
+	return tsf_hydra_preload_records(f->hydra);
+}
+
+// Read hydra records and (if aligned for 16-bit access) sample data directly from a loaded SoundFont in memory
+static void tsf_set_resident_memory(tsf* f, const char* buffer, unsigned int size)
+{
+	int avail = (size - f->fontSamplesOffset) / sizeof(short);
+	f->hydra->memory = buffer;
+	if (f->compressedNum || ((size_t)(buffer + f->fontSamplesOffset) & 1)) return;
+	if (f->fontSamples24Offset && avail > (int)(size - f->fontSamples24Offset)) avail = size - f->fontSamples24Offset;
+	tsf_set_resident_samples(f, (const short*)(buffer + f->fontSamplesOffset), (f->fontSamples24Offset ? (const unsigned char*)buffer + f->fontSamples24Offset : TSF_NULL), avail);
+}
+
+TSFDEF int tsf_preload_samples(tsf* f)
+{
+	unsigned int count = f->fontSampleCount + TSF_SAMPLEPADDING;
+	char* alloc;
+	short* samples;
+	unsigned char* low = TSF_NULL;
+	if (f->fontSamples) return 1;
+	if (f->cache.streaming) return 0;
+
+	// Align the sample data to 32 bytes for vector loads, the low bytes of 24-bit samples follow it
+	alloc = (char*)TSF_MALLOC(count * sizeof(short) + 31 + (f->fontSamples24Offset ? count : 0));
+	if (!alloc) return 0;
+	samples = (short*)(alloc + ((32 - ((size_t)alloc & 31)) & 31));
+	if (f->fontSamples24Offset) low = (unsigned char*)(samples + count);
+	if (!tsf_read_sample_data(f, samples, 0, f->fontSampleCount) || (low && !tsf_read_sample_data24(f, low, 0, f->fontSampleCount)))
+	{
+		TSF_FREE(alloc);
+		return 0;
+	}
+	TSF_MEMSET(samples + f->fontSampleCount, 0, TSF_SAMPLEPADDING * sizeof(short));
+	if (low) TSF_MEMSET(low + f->fontSampleCount, 0, TSF_SAMPLEPADDING);
+	f->fontSamplesAlloc = alloc;
+	tsf_set_resident_samples(f, samples, low, count);
+	return 1;
+}
+
+TSFDEF void tsf_set_sample_decoder(tsf* f, const struct tsf_sample_decoder* decoder)
+{
+	int i;
+	for (i = 0; i < f->compressedNum; i++)
+	{
+		struct tsf_compressed_sample* c = &f->compressed[i];
+		if (c->handle) f->decoder.close(f->decoder.data, c->handle);
+		TSF_FREE(c->data);
+		c->handle = TSF_NULL;
+		c->data = TSF_NULL;
+	}
+	if (decoder) f->decoder = *decoder;
+	else TSF_MEMSET(&f->decoder, 0, sizeof(f->decoder));
+}
+
+#define TSF_BANK_VERSION 2
+#define TSF_BANK_BYTEORDER 0x01020304
+
+struct tsf_bank_header
+{
+	char magic[4]; // "TSFB"
+	tsf_u32 version, byteOrder, regionSize;
+	tsf_u32 presetNum, regionNum, sampleCount;
+	tsf_u32 presetsOffset, regionsOffset, samplesOffset, samples24Offset, size; // samples24Offset is 0 without 24-bit samples
+};
+struct tsf_bank_preset { tsf_char20 presetName; tsf_u16 preset, bank; tsf_u32 regionIndex, regionNum; };
+
+TSFDEF int tsf_save_bank_memory(tsf* f, void* buffer, int size)
+{
+	struct tsf_bank_header h;
+	struct tsf_bank_preset bp;
+	char* out = (char*)buffer;
+	int i, regionNum = 0;
+	if (f->cache.streaming || !tsf_preload_presets(f, TSF_NULL, 0)) return 0;
+	for (i = 0; i != f->presetNum; i++) regionNum += f->presets[i].regionNum;
+
+	TSF_MEMCPY(h.magic, "TSFB", 4);
+	h.version = TSF_BANK_VERSION;
+	h.byteOrder = TSF_BANK_BYTEORDER;
+	h.regionSize = sizeof(struct tsf_region);
+	h.presetNum = f->presetNum;
+	h.regionNum = regionNum;
+	h.sampleCount = f->fontSampleCount;
+	h.presetsOffset = sizeof(h);
+	h.regionsOffset = (h.presetsOffset + f->presetNum * sizeof(struct tsf_bank_preset) + 7) & ~7;
+	h.samplesOffset = (h.regionsOffset + regionNum * sizeof(struct tsf_region) + 31) & ~31; // aligned for vector loads
+	h.size = h.samplesOffset + (f->fontSampleCount + TSF_SAMPLEPADDING) * sizeof(short);
+	h.samples24Offset = (f->fontSamples24Offset ? h.size : 0);
+	if (h.samples24Offset) h.size += f->fontSampleCount + TSF_SAMPLEPADDING;
+	if (!buffer) return (int)h.size;
+	if (size < (int)h.size) return 0;
+
+	TSF_MEMSET(out, 0, h.samplesOffset);
+	TSF_MEMCPY(out, &h, sizeof(h));
+	for (i = 0, regionNum = 0; i != f->presetNum; i++)
+	{
+		struct tsf_preset* preset = &f->presets[i];
+		TSF_MEMCPY(bp.presetName, preset->presetName, sizeof(bp.presetName));
+		bp.preset = preset->preset;
+		bp.bank = preset->bank;
+		bp.regionIndex = regionNum;
+		bp.regionNum = preset->regionNum;
+		TSF_MEMCPY(out + h.presetsOffset + i * sizeof(bp), &bp, sizeof(bp));
+		TSF_MEMCPY(out + h.regionsOffset + regionNum * sizeof(struct tsf_region), preset->regions, preset->regionNum * sizeof(struct tsf_region));
+		regionNum += preset->regionNum;
+	}
+	if (f->fontSamples)
+		TSF_MEMCPY(out + h.samplesOffset, f->fontSamples, f->fontSampleCount * sizeof(short));
+	else if (!tsf_read_sample_data(f, (short*)(out + h.samplesOffset), 0, f->fontSampleCount))
+		return 0;
+	TSF_MEMSET(out + h.samplesOffset + f->fontSampleCount * sizeof(short), 0, TSF_SAMPLEPADDING * sizeof(short));
+	if (h.samples24Offset)
+	{
+		if (f->fontSamples24)
+			TSF_MEMCPY(out + h.samples24Offset, f->fontSamples24, f->fontSampleCount);
+		else if (!tsf_read_sample_data24(f, (unsigned char*)out + h.samples24Offset, 0, f->fontSampleCount))
+			return 0;
+		TSF_MEMSET(out + h.samples24Offset + f->fontSampleCount, 0, TSF_SAMPLEPADDING);
+	}
+	return (int)h.size;
+}
+
+#ifndef TSF_NO_STDIO
+TSFDEF int tsf_save_bank_filename(tsf* f, const char* filename)
+{
+	int size = tsf_save_bank_memory(f, TSF_NULL, 0), res = 0;
+	char* buffer = (size ? (char*)TSF_MALLOC(size) : TSF_NULL);
+	FILE* file;
+	if (!buffer) return 0;
+	if (tsf_save_bank_memory(f, buffer, size))
+	{
+		#if __STDC_WANT_SECURE_LIB__
+		file = TSF_NULL; fopen_s(&file, filename, "wb");
+		#else
+		file = fopen(filename, "wb");
+		#endif
+		if (file)
+		{
+			res = (fwrite(buffer, 1, size, file) == (size_t)size);
+			if (fclose(file)) res = 0;
+		}
+	}
+	TSF_FREE(buffer);
+	return res;
+}
+#endif
+
+static tsf* tsf_load_bank(struct tsf_stream* stream, const char* buffer, unsigned int size)
+{
+	struct tsf_bank_header h;
+	struct tsf_bank_preset bp;
+	tsf* res;
+	int i;
+	TSF_MEMCPY(&h, buffer, sizeof(h));
+	if (h.version != TSF_BANK_VERSION || h.byteOrder != TSF_BANK_BYTEORDER || h.regionSize != sizeof(struct tsf_region)) return TSF_NULL;
+	if (h.size > size || h.presetsOffset < sizeof(h) || h.regionsOffset < h.presetsOffset || h.samplesOffset < h.regionsOffset || h.samplesOffset > h.size
+		|| h.presetNum > (h.regionsOffset - h.presetsOffset) / sizeof(struct tsf_bank_preset)
+		|| h.regionNum > (h.samplesOffset - h.regionsOffset) / sizeof(struct tsf_region)
+		|| h.sampleCount > (h.size - h.samplesOffset) / sizeof(short)
+		|| (h.samples24Offset && (h.samples24Offset < h.samplesOffset + h.sampleCount * sizeof(short) || h.sampleCount > h.size - h.samples24Offset))) return TSF_NULL;
+
+	res = (tsf*)TSF_MALLOC(sizeof(tsf));
+	if (!res) return TSF_NULL;
+	TSF_MEMSET(res, 0, sizeof(tsf));
+	res->presetNum = h.presetNum;
+	res->presets = (struct tsf_preset*)TSF_MALLOC(res->presetNum * sizeof(struct tsf_preset));
+	res->presetRequests = (int*)TSF_MALLOC((res->presetNum + 1) * sizeof(int));
+	res->hydra = (struct tsf_hydra*)TSF_MALLOC(sizeof(struct tsf_hydra));
+	if (res->presets) TSF_MEMSET(res->presets, 0, res->presetNum * sizeof(struct tsf_preset));
+	if (res->hydra) TSF_MEMSET(res->hydra, 0, sizeof(struct tsf_hydra));
+	if ((!res->presets && res->presetNum) || !res->presetRequests || !res->hydra) goto error;
+	res->hydra->stream = (struct tsf_stream*)TSF_MALLOC(sizeof(struct tsf_stream));
+	if (!res->hydra->stream) goto error;
+	TSF_MEMCPY(res->hydra->stream, stream, sizeof(*res->hydra->stream));
+	res->fontSamplesOffset = h.samplesOffset;
+	res->fontSampleCount = h.sampleCount;
+	res->fontSamples24Offset = h.samples24Offset;
+	res->outSampleRate = 44100.0f;
+	res->interpolation = TSF_INTERPOLATION_LINEAR;
+
+	// Use the regions in place if the buffer is aligned for them
+	if (((size_t)(buffer + h.regionsOffset) & (sizeof(int) - 1)) == 0)
+		res->bankRegions = (const struct tsf_region*)(buffer + h.regionsOffset);
+	else
+	{
+		res->bankRegionsAlloc = TSF_MALLOC(h.regionNum * sizeof(struct tsf_region) + 1);
+		if (!res->bankRegionsAlloc) goto error;
+		TSF_MEMCPY(res->bankRegionsAlloc, buffer + h.regionsOffset, h.regionNum * sizeof(struct tsf_region));
+		res->bankRegions = (const struct tsf_region*)res->bankRegionsAlloc;
+	}
+
+	for (i = 0; i != res->presetNum; i++)
+	{
+		struct tsf_preset* preset = &res->presets[i];
+		TSF_MEMCPY(&bp, buffer + h.presetsOffset + i * sizeof(bp), sizeof(bp));
+		if (bp.regionIndex > h.regionNum || bp.regionNum > h.regionNum - bp.regionIndex) goto error;
+		TSF_MEMCPY(preset->presetName, bp.presetName, sizeof(preset->presetName));
+		preset->presetName[sizeof(preset->presetName) - 1] = '\0';
+		preset->preset = bp.preset;
+		preset->bank = bp.bank;
+		preset->phdrIndex = -1;
+		preset->loadState = TSF_PRESET_LOADED;
+		preset->regions = (struct tsf_region*)(res->bankRegions + bp.regionIndex);
+		preset->regionNum = bp.regionNum;
+		if (!tsf_preset_keymap(preset)) goto error;
+	}
+
+	// Cached sample (only used if the sample data in the buffer is not aligned for 16-bit access)
+	if (!tsf_sample_cache_init(&res->cache, TSF_BUFFS, TSF_BUFFSIZE, res->fontSamples24Offset != 0)) goto error;
+	return res;
+
+error:
+	if (res->hydra) TSF_FREE(res->hydra->stream);
+	TSF_FREE(res->hydra);
+	TSF_FREE(res->bankRegionsAlloc);
+	TSF_FREE(res->presetRequests);
+	for (i = 0; res->presets && i != res->presetNum; i++) TSF_FREE(res->presets[i].keyRegions);
+	TSF_FREE(res->presets);
+	TSF_FREE(res);
+	return TSF_NULL;
+}
+
+// Load a SoundFont or precompiled bank that is fully in memory and play it from there
+static tsf* tsf_load_resident(struct tsf_stream* stream, const char* buffer, unsigned int size)
+{
+	tsf* res;
+	if (size >= sizeof(struct tsf_bank_header) && TSF_FourCCEquals(buffer, "TSFB"))
+		res = tsf_load_bank(stream, buffer, size);
+	else
+		res = tsf_load(stream);
+	if (res) tsf_set_resident_memory(res, buffer, size);
+	return res;
+}
+
 TSFDEF void tsf_set_output(tsf* f, enum TSFOutputMode outputmode, int samplerate, float globalgaindb)
 {
 	f->outSampleRate = (float)(samplerate >= 1 ? samplerate : 44100.0f);
@@ -1489,52 +3164,168 @@ TSFDEF void tsf_set_output(tsf* f, enum TSFOutputMode outputmode, int samplerate
 	f->globalGainDB = globalgaindb;
 }
 
+TSFDEF int tsf_set_interpolation(tsf* f, enum TSFInterpolation interpolation)
+{
+	int taps = (interpolation == TSF_INTERPOLATION_SINC8 ? 8 : interpolation == TSF_INTERPOLATION_SINC16 ? 16 : 0), p, k;
+	float* table = TSF_NULL;
+	if ((unsigned int)interpolation > (unsigned int)TSF_INTERPOLATION_SINC16) return 0;
+	if (taps && taps != f->sincTaps)
+	{
+		// Blackman windowed sinc for each fractional position, normalized to unity gain
+		table = (float*)TSF_MALLOC((TSF_SINC_PHASES + 1) * taps * (sizeof(float) + sizeof(int32_t)));
+		if (!table) return 0;
+		for (p = 0; p <= TSF_SINC_PHASES; p++)
+		{
+			float* row = table + p * taps, sum = 0;
+			for (k = 0; k != taps; k++)
+			{
+				double x = (1 - taps / 2 + k) - (double)p / TSF_SINC_PHASES, w = 0.5 + x / taps;
+				double px = TSF_PI * x, y = (x == 0 ? 1.0 : TSF_SIN(px) / px);
+				w = (w <= 0 || w >= 1 ? 0.0 : 0.42 - 0.5 * TSF_COS(2 * TSF_PI * w) + 0.08 * TSF_COS(4 * TSF_PI * w));
+				sum += row[k] = (float)(y * w);
+			}
+			for (k = 0; k != taps; k++) row[k] /= sum;
+		}
+		for (k = 0; k != (TSF_SINC_PHASES + 1) * taps; k++)
+			((int32_t*)(table + (TSF_SINC_PHASES + 1) * taps))[k] = (int32_t)(table[k] * 1073741824.0f + (table[k] < 0 ? -0.5f : 0.5f));
+		TSF_FREE(f->sincTable);
+		f->sincTable = table;
+		f->sincTableFixed = (int32_t*)(table + (TSF_SINC_PHASES + 1) * taps);
+		f->sincTaps = taps;
+	}
+	f->interpolation = interpolation;
+	return 1;
+}
+
+TSFDEF int tsf_set_max_voices(tsf* f, int max_voices)
+{
+	int i, voiceNum = (max_voices > 0 ? max_voices + TSF_VOICE_FADE_RESERVE : 0);
+	struct tsf_voice* voices = TSF_NULL; int *activeVoices = TSF_NULL, *freeVoices = TSF_NULL;
+	if (voiceNum)
+	{
+		voices = (struct tsf_voice*)TSF_MALLOC(voiceNum * sizeof(struct tsf_voice));
+		activeVoices = (int*)TSF_MALLOC(voiceNum * sizeof(int));
+		freeVoices = (int*)TSF_MALLOC(voiceNum * sizeof(int));
+		if (!voices || !activeVoices || !freeVoices) { TSF_FREE(voices); TSF_FREE(activeVoices); TSF_FREE(freeVoices); return 0; }
+	}
+	for (i = 0; i < voiceNum; i++) voices[i].playingPreset = -1, freeVoices[i] = voiceNum - 1 - i;
+	TSF_FREE(f->voices);
+	TSF_FREE(f->activeVoices);
+	TSF_FREE(f->freeVoices);
+	f->voices = voices;
+	f->activeVoices = activeVoices;
+	f->freeVoices = freeVoices;
+	f->voiceNum = f->freeVoiceNum = voiceNum;
+	f->activeVoiceNum = f->playingVoiceNum = 0;
+	f->maxVoiceNum = (max_voices > 0 ? max_voices : 0);
+	TSF_MEMSET(f->keyVoices, 0, sizeof(f->keyVoices));
+	TSF_MEMSET(f->groupVoices, 0, sizeof(f->groupVoices));
+	return 1;
+}
+
+// Add 'num' unused voices to the growing voice pool
+static TSF_BOOL tsf_voice_pool_grow(tsf* f, int num)
+{
+	int i, voiceNum = f->voiceNum + num;
+	struct tsf_voice* voices; int *activeVoices, *freeVoices;
+	if ((voices = (struct tsf_voice*)TSF_REALLOC(f->voices, voiceNum * sizeof(struct tsf_voice))) != TSF_NULL) f->voices = voices;
+	if ((activeVoices = (int*)TSF_REALLOC(f->activeVoices, voiceNum * sizeof(int))) != TSF_NULL) f->activeVoices = activeVoices;
+	if ((freeVoices = (int*)TSF_REALLOC(f->freeVoices, voiceNum * sizeof(int))) != TSF_NULL) f->freeVoices = freeVoices;
+	if (!voices || !activeVoices || !freeVoices) return TSF_FALSE;
+	for (i = voiceNum - 1; i >= f->voiceNum; i--) voices[i].playingPreset = -1, freeVoices[f->freeVoiceNum++] = i;
+	f->voiceNum = voiceNum;
+	return TSF_TRUE;
+}
+
+TSFDEF void tsf_set_voice_stealing(tsf* f, enum TSFVoiceStealing policy)
+{
+	f->voiceStealing = policy;
+}
+
+// Choose the voice a new note of 'preset' takes over, fading voices only if 'fading' is set
+// Voices started by the same note (with a play index from 'noteIndex' on) are never chosen.
+static struct tsf_voice* tsf_voice_steal(tsf* f, int preset, unsigned int noteIndex, TSF_BOOL fading)
+{
+	struct tsf_voice *v, *res = TSF_NULL;
+	float score, best = 0;
+	int i;
+	for (i = 0; i != f->activeVoiceNum; i++)
+	{
+		v = &f->voices[f->activeVoices[i]];
+		if (v->fading != fading || (int)(v->playIndex - noteIndex) >= 0) continue;
+		switch (fading ? TSF_STEAL_QUIETEST : f->voiceStealing)
+		{
+			case TSF_STEAL_QUIETEST: score = -v->ampenv.level; break;
+			case TSF_STEAL_OLDEST: score = (float)(f->voicePlayIndex - v->playIndex); break;
+			case TSF_STEAL_SAME_PRESET: score = (v->playingPreset == preset ? 4.0f : 0.0f) + (v->ampenv.segment == TSF_SEGMENT_RELEASE ? 2.0f : 0.0f) - v->ampenv.level; break;
+			default: score = (v->ampenv.segment == TSF_SEGMENT_RELEASE ? 2.0f : 0.0f) - v->ampenv.level; break;
+		}
+		if (!res || score > best) { res = v; best = score; }
+	}
+	return res;
+}
+
 TSFDEF void tsf_note_on(tsf* f, int preset, int key, float vel)
 {
 	int midiVelocity = (int)(vel * 127);
-	TSF_BOOL haveGroupedNotesPlaying = TSF_FALSE;
-	struct tsf_voice *v, *vEnd; struct tsf_region *region, *regionEnd;
+	unsigned int noteIndex = f->voicePlayIndex;
+	struct tsf_voice *v; const int* keyRegions; int i, r;
 
 	if (preset < 0 || preset >= f->presetNum) return;
-	if (f->presets[preset].regions == NULL) tsf_load_preset(f, f->hydra, preset);
-
-	// Are any grouped notes playing? (Needed for group stopping) Also stop any voices still playing this note.
-	for (v = f->voices, vEnd = v + f->voiceNum; v != vEnd; v++)
+	switch (TSF_ATOMIC_LOAD(&f->presets[preset].loadState))
 	{
-		if (v->playingPreset != preset) continue;
-		if (v->playingKey == key) tsf_voice_endquick(v, f->outSampleRate);
-		if (v->region->group) haveGroupedNotesPlaying = TSF_TRUE;
+		case TSF_PRESET_UNLOADED: if (f->cache.streaming) return; tsf_preload_presets(f, &preset, 1); break;
+		case TSF_PRESET_QUEUED: return; // still being loaded by tsf_stream_service
 	}
 
+	// Stop any voices still playing this note.
+	for (i = f->keyVoices[key & 127]; i; i = v->keyNext)
+		if ((v = &f->voices[i - 1])->playingPreset == preset && v->playingKey == key)
+			tsf_voice_endquick(f, v);
+
 	// Play all matching regions.
-	for (region = f->presets[preset].regions, regionEnd = region + f->presets[preset].regionNum; region != regionEnd; region++)
+	if (key < 0 || key > 127 || !(keyRegions = f->presets[preset].keyRegions)) return;
+	for (r = keyRegions[key]; r != keyRegions[key + 1]; r++)
 	{
 		struct tsf_voice* voice = TSF_NULL; double adjustedPan; TSF_BOOL doLoop; float filterQDB;
-		if (key < region->lokey || key > region->hikey || midiVelocity < region->lovel || midiVelocity > region->hivel) continue;
+		struct tsf_region* region = &f->presets[preset].regions[keyRegions[r]];
+		if (midiVelocity < region->lovel) break;
+		if (midiVelocity > region->hivel) continue;
 
-		if (haveGroupedNotesPlaying && region->group)
-			for (v = f->voices, vEnd = v + f->voiceNum; v != vEnd; v++)
-				if (v->playingPreset == preset && v->region->group == region->group)
-					tsf_voice_endquick(v, f->outSampleRate);
+		// Stop the voices of the same exclusive class.
+		if (region->group)
+			for (i = f->groupVoices[region->group % TSF_VOICE_GROUP_BUCKETS]; i; i = v->groupNext)
+				if ((v = &f->voices[i - 1])->playingPreset == preset && v->region->group == region->group)
+					tsf_voice_endquick(f, v);
 
-		for (v = f->voices, vEnd = v + f->voiceNum; v != vEnd; v++) if (v->playingPreset == -1) { voice = v; break; }
-		if (!voice)
+		if (f->maxVoiceNum && f->playingVoiceNum >= f->maxVoiceNum)
 		{
-			f->voiceNum += 4;
-			struct tsf_voice *saveVoice = f->voices;
-			f->voices = (struct tsf_voice*)TSF_REALLOC(f->voices, f->voiceNum * sizeof(struct tsf_voice));
-			if (!f->voices) {
-				f->voices = saveVoice;
-				printf("OOM, no room for new voice.  Ignoring note_on\n");
-				return;
-			}
-			voice = &f->voices[f->voiceNum - 4];
-			voice[1].playingPreset = voice[2].playingPreset = voice[3].playingPreset = -1;
+			// Fade out a voice and play in a free voice of the reserve, or else cut the quietest fading voice.
+			// If all playing voices belong to this note its remaining regions are skipped so the reserve
+			// stays free for fading voices.
+			struct tsf_voice* victim = tsf_voice_steal(f, preset, noteIndex, TSF_FALSE);
+			if (!victim) break;
+			tsf_voice_endquick(f, victim);
 		}
+		if (!f->freeVoiceNum && !f->maxVoiceNum) tsf_voice_pool_grow(f, 4);
+		if (f->freeVoiceNum)
+		{
+			// Take an unused voice and add it to the playing voices
+			voice = &f->voices[f->freeVoices[--f->freeVoiceNum]];
+			voice->activeIndex = f->activeVoiceNum;
+			f->activeVoices[f->activeVoiceNum++] = (int)(voice - f->voices);
+		}
+		if (!voice) voice = tsf_voice_steal(f, preset, noteIndex, TSF_TRUE);
+		if (!voice && (voice = tsf_voice_steal(f, preset, noteIndex, TSF_FALSE)) == TSF_NULL) continue;
+		if (voice->playingPreset != -1) { tsf_voice_unlink(f, voice); if (!voice->fading) f->playingVoiceNum--; }
+		voice->fading = TSF_FALSE;
+		f->playingVoiceNum++;
 
 		voice->region = region;
 		voice->playingPreset = preset;
 		voice->playingKey = key;
+		voice->playIndex = f->voicePlayIndex++;
+		tsf_voice_link(f, voice);
 
 		// Pitch.
 		voice->curPitchWheel = 8192;
@@ -1551,7 +3342,6 @@ TSFDEF void tsf_note_on(tsf* f, int preset, int key, float vel)
 
 		// Offset/end.
 		voice->sourceSamplePosition = region->offset;
-    		voice->sourceSamplePositionF32P32 = ((int64_t)region->offset)<< 32;
 		voice->sampleEnd = f->fontSampleCount;
 		if (region->end > 0 && region->end < voice->sampleEnd) voice->sampleEnd = region->end + 1;
 
@@ -1571,68 +3361,108 @@ TSFDEF void tsf_note_on(tsf* f, int preset, int key, float vel)
 		voice->lowpass.active = (region->initialFilterFc <= 13500);
 		if (voice->lowpass.active) tsf_voice_lowpass_setup(&voice->lowpass, tsf_cents2Hertz((float)region->initialFilterFc) / f->outSampleRate);
 
+		// Start in the fixed point state so tsf_render_short_fast needs no conversion, the one to floating point is exact
+		voice->sourceSamplePositionFixed = (fixed32p32)region->offset << 32;
+		voice->lowpassFixed.z1 = voice->lowpassFixed.z2 = 0;
+		if (voice->lowpass.active) tsf_voice_lowpass_fixed_setup(&voice->lowpassFixed, &voice->lowpass);
+		voice->fixedState = TSF_TRUE;
+
 		// Setup LFO filters.
 		tsf_voice_lfo_setup(&voice->modlfo, region->delayModLFO, region->freqModLFO, f->outSampleRate);
 		tsf_voice_lfo_setup(&voice->viblfo, region->delayVibLFO, region->freqVibLFO, f->outSampleRate);
+
+		// Read the attack and the loop start before the first render.
+		tsf_voice_prefetch(f, voice, region->offset, 0);
 	}
 }
 
 TSFDEF void tsf_note_off(tsf* f, int preset, int key)
 {
-	struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum;
-	for (; v != vEnd; v++)
-		if (v->playingPreset == preset && v->playingKey == key)
-			tsf_voice_end(v, f->outSampleRate);
+	struct tsf_voice* v;
+	int i;
+	for (i = f->keyVoices[key & 127]; i; i = v->keyNext)
+		if ((v = &f->voices[i - 1])->playingPreset == preset && v->playingKey == key)
+			tsf_voice_end(f, v);
 }
 
-TSFDEF void tsf_render_short(tsf* f, short* buffer, int samples, int flag_mixing)
+// Convert 'n' float samples to 16-bit with saturation, adding them to 'out' if 'flag_mixing' is set
+static void tsf_pack_short(short* out, const float* in, int n, int flag_mixing)
 {
-	float *floatSamples;
-	int channelSamples = (f->outputmode == TSF_MONO ? 1 : 2) * samples, floatBufferSize = channelSamples * sizeof(float);
-	short* bufferEnd = buffer + channelSamples;
-	if (floatBufferSize > f->outputSampleSize)
+	int i = 0;
+	#if defined(TSF_SSE2)
+	// Clamping to -2 .. 2 keeps the conversion in range, the pack then saturates like the plain C code
+	__m128 lo = _mm_set1_ps(-2.0f), hi = _mm_set1_ps(2.0f), scale = _mm_set1_ps(32767.5f);
+	for (; i + 8 <= n; i += 8)
 	{
-		TSF_FREE(f->outputSamples);
-		f->outputSamples = (float*)TSF_MALLOC(floatBufferSize);
-		f->outputSampleSize = floatBufferSize;
+		__m128i a = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), lo), hi), scale));
+		__m128i b = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), lo), hi), scale));
+		__m128i v = _mm_packs_epi32(a, b);
+		if (flag_mixing) v = _mm_adds_epi16(v, _mm_loadu_si128((const __m128i*)(out + i)));
+		_mm_storeu_si128((__m128i*)(out + i), v);
 	}
+	#elif defined(TSF_NEON)
+	// The conversion and the narrowing both saturate like the plain C code
+	float32x4_t scale = vdupq_n_f32(32767.5f);
+	for (; i + 8 <= n; i += 8)
+	{
+		int16x8_t v = vcombine_s16(vqmovn_s32(vcvtq_s32_f32(vmulq_f32(vld1q_f32(in + i), scale))), vqmovn_s32(vcvtq_s32_f32(vmulq_f32(vld1q_f32(in + i + 4), scale))));
+		if (flag_mixing) v = vqaddq_s16(v, vld1q_s16(out + i));
+		vst1q_s16(out + i, v);
+	}
+	#endif
+	for (; i < n; i++)
+	{
+		float v = in[i];
+		int vi = (v < -1.00004566f ? (int)-32768 : (v > 1.00001514f ? (int)32767 : (int)(v * 32767.5f)));
+		if (flag_mixing) vi += out[i];
+		out[i] = (vi < -32768 ? (short)-32768 : (vi > 32767 ? (short)32767 : (short)vi));
+	}
+}
 
-	tsf_render_float(f, f->outputSamples, samples, TSF_FALSE);
-
-	floatSamples = f->outputSamples;
-	if (flag_mixing) 
-		while (buffer != bufferEnd)
-		{
-			float v = *floatSamples++;
-			int vi = *buffer + (v < -1.00004566f ? (int)-32768 : (v > 1.00001514f ? (int)32767 : (int)(v * 32767.5f)));
-			*buffer++ = (vi < -32768 ? (short)-32768 : (vi > 32767 ? (short)32767 : (short)vi));
-		}
-	else
-		while (buffer != bufferEnd)
+TSFDEF void tsf_render_short(tsf* f, short* buffer, int samples, int flag_mixing)
+{
+	// Render in chunks through the buffer in the struct so this never allocates memory
+	float* floatSamples = f->shortSamples;
+	int channels = (f->outputmode == TSF_MONO ? 1 : 2), done, n;
+	for (done = 0; done != samples; done += n)
+	{
+		n = (samples - done > TSF_RENDER_SHORTBLOCK ? TSF_RENDER_SHORTBLOCK : samples - done);
+		tsf_render_float(f, floatSamples, n, TSF_FALSE);
+		if (f->outputmode == TSF_STEREO_UNWEAVED)
 		{
-			float v = *floatSamples++;
-			*buffer++ = (v < -1.00004566f ? (short)-32768 : (v > 1.00001514f ? (short)32767 : (short)(v * 32767.5f)));
+			tsf_pack_short(buffer + done, floatSamples, n, flag_mixing);
+			tsf_pack_short(buffer + samples + done, floatSamples + n, n, flag_mixing);
 		}
+		else tsf_pack_short(buffer + done * channels, floatSamples, n * channels, flag_mixing);
+	}
 }
 
 TSFDEF void tsf_render_float(tsf* f, float* buffer, int samples, int flag_mixing)
 {
-	struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum;
+	int i = 0;
 	if (!flag_mixing) TSF_MEMSET(buffer, 0, (f->outputmode == TSF_MONO ? 1 : 2) * sizeof(float) * samples);
-	for (; v != vEnd; v++)
-		if (v->playingPreset != -1)
-			tsf_voice_render(f, v, buffer, samples);
+	while (i != f->activeVoiceNum)
+	{
+		// A voice that stops is replaced by the last playing voice which then gets rendered next
+		int index = f->activeVoices[i];
+		if (f->voices[index].fixedState) tsf_voice_state_to_float(&f->voices[index]);
+		tsf_voice_render(f, &f->voices[index], buffer, samples);
+		if (i != f->activeVoiceNum && f->activeVoices[i] == index) i++;
+	}
 }
 
 TSFDEF void tsf_render_short_fast(tsf* f, short* buffer, int samples, int flag_mixing)
 {
-  struct tsf_voice *v = f->voices, *vEnd = v + f->voiceNum;
-  if (!flag_mixing) TSF_MEMSET(buffer, 0, (f->outputmode == TSF_MONO ? 1 : 2) * sizeof(short) * samples);
-  for (; v != vEnd; v++) {
-    if (v->playingPreset != -1)
-      tsf_voice_render_fast(f, v, buffer, samples);
-    yield();
-  }
+	int i = 0;
+	if (!flag_mixing) TSF_MEMSET(buffer, 0, (f->outputmode == TSF_MONO ? 1 : 2) * sizeof(short) * samples);
+	while (i != f->activeVoiceNum)
+	{
+		int index = f->activeVoices[i];
+		if (!f->voices[index].fixedState) tsf_voice_state_to_fixed(&f->voices[index]);
+		tsf_voice_render_fast(f, &f->voices[index], buffer, samples);
+		if (i != f->activeVoiceNum && f->activeVoices[i] == index) i++;
+		TSF_YIELD();
+	}
 }
 
 